@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "feed_publisher.h"
+
+namespace tup::backend {
+
+  /**
+   * Publishes the union of several trip updates feeds whenever one of them
+   * is published. Entity ids are prefixed with "<feed name>:" to keep them
+   * unique across feeds.
+   */
+  class feed_combiner {
+  public:
+    feed_combiner(std::vector<std::pair<std::string, feed_publisher*>> sources,
+                  feed_publisher& target);
+    ~feed_combiner();
+
+    feed_combiner(feed_combiner const&) = delete;
+    feed_combiner& operator=(feed_combiner const&) = delete;
+
+  private:
+    void combine();
+
+    std::vector<std::pair<std::string, feed_publisher*>> sources_;
+    feed_publisher& target_;
+    std::mutex mutex_;
+    std::vector<std::uint64_t> subscriptions_;
+  };
+
+}  // namespace tup::backend
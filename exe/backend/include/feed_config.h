@@ -0,0 +1,37 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace tup::backend {
+
+  /// An upstream vehicle positions feed and how to predict trip updates for it.
+  struct feed_config {
+    /// Unique name, the trip updates are served at /tripUpdates/<name>
+    std::string name_;
+    std::string url_;
+    /// Input path (or its file name) of the GTFS dataset the feed refers to, empty for all
+    std::string dataset_;
+    std::string predictor_;
+    /// Directory with recorded trip updates for the historic predictor
+    std::filesystem::path history_;
+  };
+
+  /**
+   * Reads the feeds from the config file. The file is YAML written in its
+   * JSON-compatible flow style:
+   *
+   *   {"feeds": [{"name": "stb", "url": "https://...", "dataset": "stb.zip",
+   *               "predictor": "schedule-based"}]}
+   *
+   * predictor, dataset and history are optional and default to the given
+   * values.
+   *
+   * @throws std::runtime_error if the file is malformed
+   */
+  std::vector<feed_config> read_feed_config(std::filesystem::path const& path,
+                                            std::string const& default_predictor,
+                                            std::filesystem::path const& default_history);
+
+}  // namespace tup::backend
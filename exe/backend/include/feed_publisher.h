@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#ifdef NO_DATA
+#undef NO_DATA
+#endif
+#include "gtfs-rt/gtfs-realtime.pb.h"
+
+#include "geo/latlng.h"
+
+namespace tup::backend {
+
+  /// Looks up the position of a stop by its GTFS stop_id.
+  using stop_locator = std::function<std::optional<geo::latlng>(std::string_view stop_id)>;
+
+  /// A wire format of a feed, computed once and served as is.
+  struct encoded_feed {
+    encoded_feed(std::string&& body, std::uint64_t version);
+
+    std::string body_;
+    std::string gzipped_;
+    std::string etag_;
+  };
+
+  /// Selects trip updates by trip, route, stop and/or area. Set criteria are combined with AND.
+  struct feed_filter {
+    bool empty() const;
+
+    /// Canonical text of the criteria, used as cache key.
+    std::string key() const;
+
+    std::optional<std::string> trip_id_;
+    std::optional<std::string> route_id_;
+    std::optional<std::string> stop_id_;
+    /// min lat, min lng, max lat, max lng
+    std::optional<std::array<double, 4>> bbox_;
+  };
+
+  /**
+   * Immutable state of the trip updates feed as published after a prediction
+   * cycle. The wire formats are computed once on publication so that serving
+   * the feed only copies bytes.
+   */
+  struct feed_snapshot {
+    /**
+     * @param feed the feed to publish
+     * @param version the version number of the feed
+     * @param locate_stop if set, the entity hashes and query indices are built
+     *                    and stops are located for bounding box queries
+     */
+    feed_snapshot(transit_realtime::FeedMessage&& feed,
+                  std::uint64_t version,
+                  stop_locator const* locate_stop);
+
+    /// JSON encoding of the feed, computed on first use.
+    encoded_feed const& json() const;
+
+    /**
+     * Returns the indices of the entities matching the filter, ascending.
+     * Requires the snapshot to be indexed.
+     */
+    std::vector<std::uint32_t> select(feed_filter const& filter) const;
+
+    transit_realtime::FeedMessage feed_;
+    std::uint64_t version_;
+    encoded_feed protobuf_;
+
+    /// Hash of every entity by its id.
+    std::unordered_map<std::string_view, std::uint64_t> entity_hashes_;
+
+    /// Entity indices by trip, route and stop id.
+    std::unordered_map<std::string_view, std::vector<std::uint32_t>> trip_entities_;
+    std::unordered_map<std::string_view, std::vector<std::uint32_t>> route_entities_;
+    std::unordered_map<std::string_view, std::vector<std::uint32_t>> stop_entities_;
+
+    /// Located stop time updates, sorted by latitude.
+    struct stop_point {
+      double lat_;
+      double lng_;
+      std::uint32_t entity_;
+    };
+    std::vector<stop_point> stop_points_;
+
+  private:
+    mutable std::once_flag json_once_;
+    mutable std::optional<encoded_feed> json_;
+  };
+
+  /**
+   * Hands the latest trip updates feed from the prediction cycle to the
+   * readers. Publishing atomically swaps the pointer to the current snapshot;
+   * readers keep the snapshot they got alive and never see a partially
+   * written feed.
+   *
+   * The last few versions are kept to answer differential requests.
+   */
+  class feed_publisher {
+  public:
+    /// Called with the new version after every publication.
+    using listener = std::function<void(std::uint64_t version)>;
+
+    /**
+     * Starts with an empty feed as version 0.
+     *
+     * @param locate_stop stop positions for bounding box queries
+     * @param history_size number of versions kept for differential requests
+     */
+    explicit feed_publisher(stop_locator locate_stop = {}, std::size_t history_size = 16U);
+
+    /// Makes feed the current snapshot with the next version number.
+    void publish(transit_realtime::FeedMessage&& feed);
+
+    /// Returns the current snapshot.
+    std::shared_ptr<feed_snapshot const> get() const;
+
+    /**
+     * Returns a DIFFERENTIAL feed with the entities that were added or changed
+     * since the given version and deletions for the ones that disappeared.
+     * Results are cached until the next publication.
+     *
+     * @param version a version previously returned to the client
+     * @return the changes or nullptr if the version is not kept anymore
+     */
+    std::shared_ptr<feed_snapshot const> get_changes_since(std::uint64_t version) const;
+
+    /**
+     * Returns the entities of the current version that match the filter.
+     * Results are cached until the next publication.
+     */
+    std::shared_ptr<feed_snapshot const> get_filtered(feed_filter const& filter) const;
+
+    /// Registers a listener and returns its id for unsubscribe.
+    std::uint64_t subscribe(listener l);
+
+    void unsubscribe(std::uint64_t id);
+
+  private:
+    static constexpr std::size_t kMaxCachedFilters = 1024U;
+
+    std::atomic<std::shared_ptr<feed_snapshot const>> current_;
+
+    stop_locator locate_stop_;
+    std::size_t history_size_;
+    mutable std::mutex mutex_;
+    std::deque<std::shared_ptr<feed_snapshot const>> history_;
+    mutable std::map<std::uint64_t, std::shared_ptr<feed_snapshot const>> changes_;
+    mutable std::unordered_map<std::string, std::shared_ptr<feed_snapshot const>> filtered_;
+    std::map<std::uint64_t, listener> listeners_;
+    std::uint64_t next_listener_{0U};
+  };
+
+}  // namespace tup::backend
@@ -2,41 +2,73 @@
 #define FEED_UPDATER_H
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <optional>
 #include <string>
 #include <functional>
-#include <thread>
+#include <utility>
 #ifdef NO_DATA
 #undef NO_DATA
 #endif
 #include "gtfs-rt/gtfs-realtime.pb.h"
 
+#include "boost/asio/awaitable.hpp"
+#include "boost/asio/io_context.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "boost/asio/strand.hpp"
+
+#include "prediction_pipeline.h"
+#include "upstream_fetcher.h"
+
 #include <functional>
 
+/**
+ * Periodically fetches the vehicle positions feed and hands new versions to
+ * the prediction pipeline. The loop is a coroutine on the given io_context,
+ * so no thread is blocked while waiting for the upstream feed or the next
+ * poll, and the next download overlaps with the prediction of the last one.
+ */
 class FeedUpdater {
 public:
-  using PredictionMethod = std::function<void(transit_realtime::FeedMessage&)>;
-
-  FeedUpdater(transit_realtime::FeedMessage& feed, const std::string& url, PredictionMethod& predictionMethod)
-      : feed_(feed), url_(url), predictionMethod_(predictionMethod) {}
+  FeedUpdater(boost::asio::io_context& ioc, const std::string& url,
+              tup::backend::prediction_pipeline& pipeline);
   ~FeedUpdater();
   void start();
+
+  /**
+   * Aborts a running download or wait immediately and returns once the loop
+   * finished. Has to be called while the io_context is still running.
+   */
   void stop();
-  transit_realtime::FeedMessage& getFeed();
 
 private:
-  void run();
-  bool downloadFeed();
+  using clock = std::chrono::steady_clock;
+
+  /// Shortest and longest time between two polls of the upstream feed
+  static constexpr auto kMinPollInterval = std::chrono::seconds{2};
+  static constexpr auto kMaxPollInterval = std::chrono::seconds{30};
+
+  boost::asio::awaitable<void> run();
+  boost::asio::awaitable<bool> downloadFeed();
+  std::chrono::milliseconds nextPollInterval(bool changed);
 
-  transit_realtime::FeedMessage& feed_;
+  boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+  boost::asio::steady_timer timer_;
   std::string url_;
-  std::thread worker_;
+  tup::backend::prediction_pipeline& pipeline_;
+  std::optional<tup::backend::upstream_fetcher> fetcher_;
   std::atomic<bool> running_{true};
-  PredictionMethod& predictionMethod_;
-  static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-    ((std::string*)userp)->append((char*)contents, size * nmemb);
-    return size * nmemb;
-  }
+  bool started_{false};
+  std::promise<void> finished_;
+  std::future<void> finishedFuture_{finished_.get_future()};
+  std::optional<clock::time_point> lastChange_;
+  /// Smoothed time between two upstream updates, 0 while unknown
+  std::chrono::duration<double> updatePeriod_{0.0};
+  std::chrono::milliseconds pollInterval_{kMinPollInterval};
+  bool lastPollChanged_{false};
 };
 
 
-#endif  // FEED_UPDATER_H
\ No newline at end of file
+#endif  // FEED_UPDATER_H
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace tup::backend {
+
+  /// CRC-32 as used by the gzip trailer.
+  std::uint32_t crc32(std::string_view data);
+
+  /**
+   * Compresses data into a gzip member (RFC 1952) that can be sent with
+   * Content-Encoding: gzip.
+   *
+   * @param data the bytes to compress
+   * @return the gzip encoded bytes
+   */
+  std::string gzip(std::string_view data);
+
+}  // namespace tup::backend
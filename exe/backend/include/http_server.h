@@ -1,22 +1,31 @@
 #pragma once
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
 
-#ifdef NO_DATA
-#undef NO_DATA
-#endif
-#include "gtfs-rt/gtfs-realtime.pb.h"
-
 #include "boost/asio/io_context.hpp"
 
+#include "feed_publisher.h"
+
 namespace tup::backend {
 
+  struct pipeline_metrics;
+
+  /// Trip updates feeds served below /tripUpdates/<name>
+  using named_feeds = std::map<std::string, feed_publisher*, std::less<>>;
+
+  /// Stage timings of the feeds, served at /metrics
+  using named_metrics = std::map<std::string, pipeline_metrics const*, std::less<>>;
+
   struct http_server {
     http_server(boost::asio::io_context& ioc,
                 boost::asio::io_context& thread_pool,
                 std::string const& static_file_path, 
-                transit_realtime::FeedMessage& feed);
+                feed_publisher& publisher,
+                named_feeds feeds = {},
+                named_metrics metrics = {});
     ~http_server();
     http_server(http_server const&) = delete;
     http_server& operator=(http_server const&) = delete;
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#ifdef NO_DATA
+#undef NO_DATA
+#endif
+#include "gtfs-rt/gtfs-realtime.pb.h"
+
+#include "tbb/task_arena.h"
+
+#include "feed_publisher.h"
+
+namespace tup::backend {
+
+  /// Run time of one pipeline stage, written by the stage and read by /metrics.
+  struct stage_metrics {
+    void record(std::chrono::steady_clock::duration d);
+
+    std::atomic<std::uint64_t> runs_{0U};
+    std::atomic<std::uint64_t> total_ns_{0U};
+    std::atomic<std::uint64_t> last_ns_{0U};
+  };
+
+  /// Timing of all stages of one feed.
+  struct pipeline_metrics {
+    stage_metrics fetch_;
+    stage_metrics parse_;
+    stage_metrics predict_;
+    stage_metrics publish_;
+    /// Fetched feeds replaced by a newer one before they were processed
+    std::atomic<std::uint64_t> dropped_{0U};
+    /// Parsed feeds skipped because their header.timestamp was already processed
+    std::atomic<std::uint64_t> duplicates_{0U};
+  };
+
+  /**
+   * Turns fetched vehicle positions feeds into published trip updates in a
+   * TBB pipeline with the stages parse, predict and publish (serialization).
+   * Every stage processes the feeds in order, but the stages of consecutive
+   * feeds overlap, so a new feed is decoded while the previous one is still
+   * predicted and the one before is serialized.
+   *
+   * At most kQueueSize fetched feeds wait for the pipeline; when a newer one
+   * arrives the oldest waiting feed is dropped since only the latest
+   * positions matter.
+   */
+  class prediction_pipeline {
+  public:
+    /// Creates the trip updates feed for the given vehicle positions feed
+    using prediction_method = std::function<transit_realtime::FeedMessage(transit_realtime::FeedMessage&)>;
+
+    prediction_pipeline(tbb::task_arena& arena,
+                        prediction_method& predict,
+                        feed_publisher& publisher);
+    ~prediction_pipeline();
+
+    prediction_pipeline(prediction_pipeline const&) = delete;
+    prediction_pipeline& operator=(prediction_pipeline const&) = delete;
+
+    /// Queues a fetched feed for processing, never blocks.
+    void push(std::string&& raw_feed);
+
+    /// Finishes the feeds in flight and stops; queued feeds are discarded.
+    void stop();
+
+    pipeline_metrics& metrics();
+
+  private:
+    static constexpr std::size_t kQueueSize = 2U;
+    /// Feeds in flight at once, one per stage
+    static constexpr std::size_t kLiveTokens = 3U;
+
+    void run();
+    std::optional<std::string> try_pop();
+
+    tbb::task_arena& arena_;
+    prediction_method& predict_;
+    feed_publisher& publisher_;
+    pipeline_metrics metrics_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::string> queue_;
+    bool stopping_{false};
+
+    /// header.timestamp of the last processed vehicle positions feed
+    std::uint64_t lastFeedTimestamp_{0U};
+    std::thread thread_;
+  };
+
+}  // namespace tup::backend
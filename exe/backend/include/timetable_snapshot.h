@@ -0,0 +1,31 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nigiri/loader/loader_interface.h"
+#include "nigiri/timetable.h"
+
+namespace tup::backend {
+
+  /**
+   * Describes the inputs a timetable was built from: every file of every
+   * input path with its size and modification time plus the given import
+   * settings. Two imports with the same fingerprint produce the same timetable.
+   */
+  std::string timetable_fingerprint(
+      std::vector<std::pair<std::string, nigiri::loader::loader_config>> const& input_files,
+      std::string const& settings);
+
+  /// Whether the snapshot at tt_path was written for the given fingerprint.
+  bool is_snapshot_valid(std::filesystem::path const& tt_path,
+                         std::string const& fingerprint);
+
+  /// Serializes the timetable to tt_path and records the fingerprint next to it.
+  void write_snapshot(nigiri::timetable const& timetable,
+                      std::filesystem::path const& tt_path,
+                      std::string const& fingerprint);
+
+}  // namespace tup::backend
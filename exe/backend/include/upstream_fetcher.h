@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+
+#include "boost/asio/any_io_executor.hpp"
+#include "boost/asio/awaitable.hpp"
+#include "boost/asio/ip/tcp.hpp"
+#include "boost/asio/ssl/context.hpp"
+#include "boost/beast/core/flat_buffer.hpp"
+#include "boost/beast/core/tcp_stream.hpp"
+#include "boost/beast/ssl/ssl_stream.hpp"
+
+namespace tup::backend {
+
+  /// Parts of an http(s) URL as needed to send a request.
+  struct url {
+    /**
+     * Parses scheme://host[:port][/path][?query].
+     *
+     * @return the parts or nullopt if the scheme is not http or https
+     */
+    static std::optional<url> parse(std::string_view str);
+
+    bool https_;
+    std::string host_;
+    std::string port_;
+    std::string target_;
+  };
+
+  /**
+   * Downloads the same resource repeatedly over one kept-alive connection.
+   * Validators of the last response are sent along so an unchanged resource
+   * costs a 304 instead of the whole body.
+   *
+   * All member functions have to be called on the executor passed to the
+   * constructor, which has to be a strand if the io_context runs on several
+   * threads.
+   */
+  class upstream_fetcher {
+  public:
+    enum class status { kModified, kNotModified, kError };
+
+    struct result {
+      status status_;
+      /// The new body, only set for kModified.
+      std::string body_;
+    };
+
+    upstream_fetcher(boost::asio::any_io_executor executor,
+                     url target,
+                     std::chrono::seconds timeout = std::chrono::seconds{30});
+
+    /// Fetches the resource; completes when the response is read, timed out or cancelled.
+    boost::asio::awaitable<result> fetch();
+
+    /// Aborts the pending fetch, it completes with kError. Later fetches fail immediately.
+    void cancel();
+
+  private:
+    boost::asio::awaitable<boost::system::error_code> connect();
+    void disconnect();
+    boost::beast::tcp_stream& tcp();
+
+    boost::asio::any_io_executor executor_;
+    url target_;
+    std::chrono::seconds timeout_;
+    bool cancelled_{false};
+    boost::asio::ip::tcp::resolver resolver_;
+    boost::asio::ssl::context ssl_ctx_;
+    std::variant<std::monostate,
+                 boost::beast::tcp_stream,
+                 boost::beast::ssl_stream<boost::beast::tcp_stream>> stream_;
+    boost::beast::flat_buffer buffer_;
+
+    std::string etag_;
+    std::string last_modified_;
+    std::uint64_t body_hash_{0U};
+  };
+
+}  // namespace tup::backend
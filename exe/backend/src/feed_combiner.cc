@@ -0,0 +1,46 @@
+#include "feed_combiner.h"
+
+#include <algorithm>
+#include <ctime>
+
+namespace tup::backend {
+
+  feed_combiner::feed_combiner(std::vector<std::pair<std::string, feed_publisher*>> sources,
+                               feed_publisher& target)
+      : sources_(std::move(sources)), target_(target) {
+    for (auto const& [name, source] : sources_) {
+      subscriptions_.push_back(source->subscribe([this](std::uint64_t) { combine(); }));
+    }
+  }
+
+  feed_combiner::~feed_combiner() {
+    for (auto i = 0U; i != sources_.size(); ++i) {
+      sources_[i].second->unsubscribe(subscriptions_[i]);
+    }
+  }
+
+  void feed_combiner::combine() {
+    // sources publish from different threads, the target expects one publisher at a time
+    auto const lock = std::scoped_lock{mutex_};
+
+    auto combined = transit_realtime::FeedMessage{};
+    transit_realtime::FeedHeader* header = combined.mutable_header();
+    header->set_gtfs_realtime_version("2.0");
+    header->set_incrementality(transit_realtime::FeedHeader_Incrementality_FULL_DATASET);
+
+    auto timestamp = std::uint64_t{0U};
+    for (auto const& [name, source] : sources_) {
+      auto const snapshot = source->get();
+      timestamp = std::max(timestamp, snapshot->feed_.header().timestamp());
+      for (auto const& entity : snapshot->feed_.entity()) {
+        auto* copy = combined.add_entity();
+        *copy = entity;
+        copy->set_id(name + ":" + entity.id());
+      }
+    }
+    header->set_timestamp(timestamp == 0U ? static_cast<std::uint64_t>(time(nullptr)) : timestamp);
+
+    target_.publish(std::move(combined));
+  }
+
+}  // namespace tup::backend
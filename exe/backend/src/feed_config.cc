@@ -0,0 +1,86 @@
+#include "feed_config.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+
+#include "boost/json.hpp"
+
+namespace json = boost::json;
+
+namespace tup::backend {
+
+  namespace {
+
+    std::string get_string(json::object const& o, std::string_view const key,
+                           std::string const& fallback, bool const required) {
+      auto const* value = o.if_contains(key);
+      if (value == nullptr) {
+        if (required) {
+          throw std::runtime_error{"feed without \"" + std::string{key} + "\""};
+        }
+        return fallback;
+      }
+      if (!value->is_string()) {
+        throw std::runtime_error{"\"" + std::string{key} + "\" has to be a string"};
+      }
+      return std::string{value->as_string()};
+    }
+
+    bool is_valid_name(std::string const& name) {
+      return !name.empty() && std::all_of(begin(name), end(name), [](char const c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               c == '-' || c == '_';
+      });
+    }
+
+  }  // namespace
+
+  std::vector<feed_config> read_feed_config(std::filesystem::path const& path,
+                                            std::string const& default_predictor,
+                                            std::filesystem::path const& default_history) {
+    auto in = std::ifstream{path};
+    if (!in) {
+      throw std::runtime_error{"cannot open " + path.generic_string()};
+    }
+    auto const content = std::string{std::istreambuf_iterator<char>{in}, {}};
+
+    auto ec = boost::system::error_code{};
+    auto const root = json::parse(content, ec);
+    if (ec) {
+      throw std::runtime_error{path.generic_string() + ": " + ec.message() +
+                               " (only the JSON-compatible YAML flow style is supported)"};
+    }
+    if (!root.is_object() || !root.as_object().contains("feeds") ||
+        !root.as_object().at("feeds").is_array()) {
+      throw std::runtime_error{path.generic_string() + ": expected a \"feeds\" list"};
+    }
+
+    auto feeds = std::vector<feed_config>{};
+    auto names = std::set<std::string>{};
+    for (auto const& entry : root.as_object().at("feeds").as_array()) {
+      if (!entry.is_object()) {
+        throw std::runtime_error{path.generic_string() + ": feeds have to be objects"};
+      }
+      auto const& o = entry.as_object();
+      auto feed = feed_config{
+          .name_ = get_string(o, "name", {}, true),
+          .url_ = get_string(o, "url", {}, true),
+          .dataset_ = get_string(o, "dataset", {}, false),
+          .predictor_ = get_string(o, "predictor", default_predictor, false),
+          .history_ = get_string(o, "history", default_history.generic_string(), false)};
+      if (!is_valid_name(feed.name_)) {
+        throw std::runtime_error{"invalid feed name \"" + feed.name_ +
+                                 "\", allowed are letters, digits, '-' and '_'"};
+      }
+      if (!names.insert(feed.name_).second) {
+        throw std::runtime_error{"duplicate feed name \"" + feed.name_ + "\""};
+      }
+      feeds.push_back(std::move(feed));
+    }
+    return feeds;
+  }
+
+}  // namespace tup::backend
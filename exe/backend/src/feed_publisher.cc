@@ -0,0 +1,278 @@
+#include "feed_publisher.h"
+
+#include <algorithm>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <utility>
+
+#include "fmt/format.h"
+
+#include "google/protobuf/util/json_util.h"
+
+#include "gzip.h"
+
+namespace tup::backend {
+
+  namespace {
+
+    /// Entity indices matching the given key, empty if there are none.
+    std::vector<std::uint32_t> lookup(
+        std::unordered_map<std::string_view, std::vector<std::uint32_t>> const& index,
+        std::string_view const key) {
+      auto const it = index.find(key);
+      return it == end(index) ? std::vector<std::uint32_t>{} : it->second;
+    }
+
+    void intersect(std::optional<std::vector<std::uint32_t>>& result,
+                   std::vector<std::uint32_t> const& entities) {
+      if (!result.has_value()) {
+        result = entities;
+        return;
+      }
+      auto intersection = std::vector<std::uint32_t>{};
+      std::set_intersection(begin(*result), end(*result), begin(entities), end(entities),
+                            std::back_inserter(intersection));
+      result = std::move(intersection);
+    }
+
+    /// Adds i to the entity list unless it was just added for the same entity.
+    void add_entity(std::vector<std::uint32_t>& entities, std::uint32_t const i) {
+      if (entities.empty() || entities.back() != i) {
+        entities.push_back(i);
+      }
+    }
+
+  }  // namespace
+
+  encoded_feed::encoded_feed(std::string&& body, std::uint64_t version)
+      : body_(std::move(body)), gzipped_(gzip(body_)) {
+    // the checksum keeps tags from before a restart from matching a new feed
+    etag_ = fmt::format("\"{}-{:08x}\"", version, crc32(body_));
+  }
+
+  bool feed_filter::empty() const {
+    return !trip_id_.has_value() && !route_id_.has_value() && !stop_id_.has_value() &&
+           !bbox_.has_value();
+  }
+
+  std::string feed_filter::key() const {
+    auto key = fmt::format("{}\n{}\n{}\n", trip_id_.value_or(""), route_id_.value_or(""),
+                           stop_id_.value_or(""));
+    if (bbox_.has_value()) {
+      key += fmt::format("{},{},{},{}", (*bbox_)[0], (*bbox_)[1], (*bbox_)[2], (*bbox_)[3]);
+    }
+    // distinguishes a missing criterion from an empty one
+    key += fmt::format("\n{}{}{}{}", trip_id_.has_value(), route_id_.has_value(),
+                       stop_id_.has_value(), bbox_.has_value());
+    return key;
+  }
+
+  feed_snapshot::feed_snapshot(transit_realtime::FeedMessage&& feed,
+                               std::uint64_t version,
+                               stop_locator const* locate_stop)
+      : feed_(std::move(feed)),
+        version_(version),
+        protobuf_(feed_.SerializeAsString(), version) {
+    if (locate_stop == nullptr) {
+      return;
+    }
+
+    // the keys point into feed_, which is never modified after this point
+    entity_hashes_.reserve(static_cast<std::size_t>(feed_.entity_size()));
+    auto bytes = std::string{};
+    for (auto i = 0U; i != static_cast<std::uint32_t>(feed_.entity_size()); ++i) {
+      auto const& entity = feed_.entity(static_cast<int>(i));
+      entity.SerializeToString(&bytes);
+      entity_hashes_.emplace(entity.id(), std::hash<std::string_view>{}(bytes));
+
+      if (!entity.has_trip_update()) {
+        continue;
+      }
+      auto const& trip_update = entity.trip_update();
+      if (trip_update.trip().has_trip_id()) {
+        add_entity(trip_entities_[trip_update.trip().trip_id()], i);
+      }
+      if (trip_update.trip().has_route_id()) {
+        add_entity(route_entities_[trip_update.trip().route_id()], i);
+      }
+      for (auto const& stop_time_update : trip_update.stop_time_update()) {
+        if (!stop_time_update.has_stop_id()) {
+          continue;
+        }
+        add_entity(stop_entities_[stop_time_update.stop_id()], i);
+        if (*locate_stop) {
+          if (auto const pos = (*locate_stop)(stop_time_update.stop_id()); pos.has_value()) {
+            stop_points_.push_back({pos->lat(), pos->lng(), i});
+          }
+        }
+      }
+    }
+    std::sort(begin(stop_points_), end(stop_points_),
+              [](stop_point const& a, stop_point const& b) { return a.lat_ < b.lat_; });
+  }
+
+  encoded_feed const& feed_snapshot::json() const {
+    std::call_once(json_once_, [&] {
+      auto body = std::string{};
+      if (auto const status = google::protobuf::util::MessageToJsonString(feed_, &body);
+          !status.ok()) {
+        std::cerr << "Failed to convert feed to JSON: " << status.ToString() << "\n";
+      }
+      json_.emplace(std::move(body), version_);
+    });
+    return *json_;
+  }
+
+  std::vector<std::uint32_t> feed_snapshot::select(feed_filter const& filter) const {
+    auto result = std::optional<std::vector<std::uint32_t>>{};
+    if (filter.trip_id_.has_value()) {
+      intersect(result, lookup(trip_entities_, *filter.trip_id_));
+    }
+    if (filter.route_id_.has_value()) {
+      intersect(result, lookup(route_entities_, *filter.route_id_));
+    }
+    if (filter.stop_id_.has_value()) {
+      intersect(result, lookup(stop_entities_, *filter.stop_id_));
+    }
+    if (filter.bbox_.has_value()) {
+      auto const [min_lat, min_lng, max_lat, max_lng] = *filter.bbox_;
+      auto const first = std::lower_bound(begin(stop_points_), end(stop_points_), min_lat,
+          [](stop_point const& p, double const lat) { return p.lat_ < lat; });
+      auto in_box = std::vector<std::uint32_t>{};
+      for (auto it = first; it != end(stop_points_) && it->lat_ <= max_lat; ++it) {
+        if (it->lng_ >= min_lng && it->lng_ <= max_lng) {
+          in_box.push_back(it->entity_);
+        }
+      }
+      std::sort(begin(in_box), end(in_box));
+      in_box.erase(std::unique(begin(in_box), end(in_box)), end(in_box));
+      intersect(result, in_box);
+    }
+
+    if (result.has_value()) {
+      return std::move(*result);
+    }
+    auto all = std::vector<std::uint32_t>(static_cast<std::size_t>(feed_.entity_size()));
+    for (auto i = 0U; i != all.size(); ++i) {
+      all[i] = i;
+    }
+    return all;
+  }
+
+  feed_publisher::feed_publisher(stop_locator locate_stop, std::size_t history_size)
+      : locate_stop_(std::move(locate_stop)),
+        history_size_(std::max(std::size_t{1U}, history_size)) {
+    auto feed = transit_realtime::FeedMessage{};
+    transit_realtime::FeedHeader* header = feed.mutable_header();
+    header->set_gtfs_realtime_version("2.0");
+    header->set_incrementality(transit_realtime::FeedHeader_Incrementality_FULL_DATASET);
+    header->set_timestamp(time(nullptr));
+    auto snapshot = std::make_shared<feed_snapshot const>(std::move(feed), 0U, &locate_stop_);
+    history_.push_back(snapshot);
+    current_.store(std::move(snapshot));
+  }
+
+  void feed_publisher::publish(transit_realtime::FeedMessage&& feed) {
+    // Only the feed updater publishes, so reading the version first is safe
+    auto const version = current_.load()->version_ + 1U;
+    auto snapshot = std::make_shared<feed_snapshot const>(std::move(feed), version, &locate_stop_);
+
+    auto listeners = std::vector<listener>{};
+    {
+      auto const lock = std::scoped_lock{mutex_};
+      history_.push_back(snapshot);
+      if (history_.size() > history_size_) {
+        history_.pop_front();
+      }
+      changes_.clear();
+      filtered_.clear();
+      current_.store(std::move(snapshot));
+      for (auto const& [id, l] : listeners_) {
+        listeners.push_back(l);
+      }
+    }
+
+    for (auto const& l : listeners) {
+      l(version);
+    }
+  }
+
+  std::shared_ptr<feed_snapshot const> feed_publisher::get() const {
+    return current_.load();
+  }
+
+  std::shared_ptr<feed_snapshot const> feed_publisher::get_changes_since(std::uint64_t version) const {
+    auto const lock = std::scoped_lock{mutex_};
+    if (auto const it = changes_.find(version); it != end(changes_)) {
+      return it->second;
+    }
+
+    auto const old_it = std::find_if(begin(history_), end(history_),
+                                     [&](auto const& s) { return s->version_ == version; });
+    if (old_it == end(history_)) {
+      return nullptr;
+    }
+    auto const& old = **old_it;
+    auto const& current = *history_.back();
+
+    auto changes = transit_realtime::FeedMessage{};
+    *changes.mutable_header() = current.feed_.header();
+    changes.mutable_header()->set_incrementality(transit_realtime::FeedHeader_Incrementality_DIFFERENTIAL);
+    for (auto const& entity : current.feed_.entity()) {
+      auto const old_hash = old.entity_hashes_.find(entity.id());
+      if (old_hash == end(old.entity_hashes_) ||
+          old_hash->second != current.entity_hashes_.at(entity.id())) {
+        *changes.add_entity() = entity;
+      }
+    }
+    for (auto const& entity : old.feed_.entity()) {
+      if (!current.entity_hashes_.contains(entity.id())) {
+        auto* deleted = changes.add_entity();
+        deleted->set_id(entity.id());
+        deleted->set_is_deleted(true);
+      }
+    }
+
+    auto snapshot = std::make_shared<feed_snapshot const>(std::move(changes), current.version_, nullptr);
+    changes_.emplace(version, snapshot);
+    return snapshot;
+  }
+
+  std::shared_ptr<feed_snapshot const> feed_publisher::get_filtered(feed_filter const& filter) const {
+    auto const lock = std::scoped_lock{mutex_};
+    auto key = filter.key();
+    if (auto const it = filtered_.find(key); it != end(filtered_)) {
+      return it->second;
+    }
+
+    auto const& current = *history_.back();
+    auto selection = transit_realtime::FeedMessage{};
+    *selection.mutable_header() = current.feed_.header();
+    for (auto const i : current.select(filter)) {
+      *selection.add_entity() = current.feed_.entity(static_cast<int>(i));
+    }
+
+    auto snapshot = std::make_shared<feed_snapshot const>(std::move(selection), current.version_, nullptr);
+    if (filtered_.size() >= kMaxCachedFilters) {
+      // arbitrary bounding boxes must not grow the cache without limit
+      filtered_.clear();
+    }
+    filtered_.emplace(std::move(key), snapshot);
+    return snapshot;
+  }
+
+  std::uint64_t feed_publisher::subscribe(listener l) {
+    auto const lock = std::scoped_lock{mutex_};
+    auto const id = next_listener_++;
+    listeners_.emplace(id, std::move(l));
+    return id;
+  }
+
+  void feed_publisher::unsubscribe(std::uint64_t id) {
+    auto const lock = std::scoped_lock{mutex_};
+    listeners_.erase(id);
+  }
+
+}  // namespace tup::backend
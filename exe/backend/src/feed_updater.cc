@@ -1,71 +1,126 @@
 #include "feed_updater.h"
+#include <algorithm>
+#include <exception>
 #include <iostream>
 #include <chrono>
-#include <thread>
 
-#include "net/http/client/https_client.h"
+#include "boost/asio/co_spawn.hpp"
+#include "boost/asio/post.hpp"
+#include "boost/asio/redirect_error.hpp"
+#include "boost/asio/use_awaitable.hpp"
 
-using namespace net::http::client;
+FeedUpdater::FeedUpdater(boost::asio::io_context& ioc, const std::string& url,
+                         tup::backend::prediction_pipeline& pipeline)
+    : strand_(boost::asio::make_strand(ioc)),
+      timer_(strand_),
+      url_(url),
+      pipeline_(pipeline) {
+  if (auto const parsed = tup::backend::url::parse(url_); parsed.has_value()) {
+    fetcher_.emplace(strand_, *parsed);
+  } else {
+    std::cerr << "Invalid vehicle positions URL: " << url_ << std::endl;
+  }
+}
 
 FeedUpdater::~FeedUpdater() {
   stop();
 }
 
 void FeedUpdater::start() {
-  worker_ = std::thread(&FeedUpdater::run, this);
+  started_ = true;
+  boost::asio::co_spawn(strand_, run(), [this](std::exception_ptr const& e) {
+    if (e) {
+      try {
+        std::rethrow_exception(e);
+      } catch (std::exception const& ex) {
+        std::cerr << "Feed updater stopped: " << ex.what() << std::endl;
+      }
+    }
+    finished_.set_value();
+  });
 }
 
 void FeedUpdater::stop() {
-  running_ = false;
-  if (worker_.joinable()) {
-    worker_.join();
+  if (!started_ || !running_.exchange(false)) {
+    return;
   }
+  boost::asio::post(strand_, [this] {
+    timer_.cancel();
+    if (fetcher_.has_value()) {
+      fetcher_->cancel();
+    }
+  });
+  finishedFuture_.wait();
 }
 
-transit_realtime::FeedMessage& FeedUpdater::getFeed() {
-  return feed_;
-}
-
-void FeedUpdater::run() {
+boost::asio::awaitable<void> FeedUpdater::run() {
   while (running_) {
-    if (!downloadFeed()) {
-      std::cerr << "Fehler beim Aktualisieren des Feeds." << std::endl;
+    auto const changed = co_await downloadFeed();
+    if (!running_) {
+      break;
     }
-    std::this_thread::sleep_for(std::chrono::seconds(30));
+    // stop() cancels on this strand, so it cannot slip in between the check and the wait
+    timer_.expires_after(nextPollInterval(changed));
+    auto ec = boost::system::error_code{};
+    co_await timer_.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
   }
 }
 
 /**
- * Downloads the vehicle Positions feed and updates the tripUpdates feed with
- * the predictionMethod
+ * Estimates when the upstream feed changes next from the time between the
+ * previous changes. Right after a change the next poll is scheduled shortly
+ * before the expected update, after that the interval grows again until a
+ * change is seen.
  *
- * @return whether everything went right
+ * @param changed whether the last poll returned a new feed
+ * @return the time to wait before the next poll
  */
-bool FeedUpdater::downloadFeed() {
-  std::string protobuf_data;
-  // Boost Asio IO Service object
-  // Represents an 'event loop' for asynchronous Input/Output operations
-  // (such as networking or timers)
-  boost::asio::io_service ios;
-  request request{url_,request::method::GET};
+std::chrono::milliseconds FeedUpdater::nextPollInterval(bool changed) {
+  using namespace std::chrono;
+  auto const now = clock::now();
+  if (changed) {
+    if (lastChange_.has_value()) {
+      auto const observed = duration<double>{now - *lastChange_};
+      updatePeriod_ = updatePeriod_.count() == 0.0 ? observed : 0.7 * updatePeriod_ + 0.3 * observed;
+    }
+    lastChange_ = now;
+    pollInterval_ = updatePeriod_.count() == 0.0
+                        ? milliseconds{kMinPollInterval}
+                        : duration_cast<milliseconds>(0.9 * updatePeriod_);
+  } else {
+    pollInterval_ = lastPollChanged_ ? milliseconds{kMinPollInterval} : 2 * pollInterval_;
+  }
+  lastPollChanged_ = changed;
+  pollInterval_ = std::clamp(pollInterval_, milliseconds{kMinPollInterval},
+                             milliseconds{kMaxPollInterval});
+  return pollInterval_;
+}
 
-  make_https(ios, request.address)
-      ->query(request, [&protobuf_data](std::shared_ptr<net::ssl> const&, response const& res,
-                          const boost::system::error_code& ec) {
-        if (ec) {
-          std::cout << "error: " << ec.message() << "\n";
-        } else {
-            protobuf_data = res.body;
-        }
-      });
+/**
+ * Downloads the vehicle Positions feed and queues it for the prediction
+ * pipeline unless it did not change since the last call.
+ *
+ * @return whether a new feed was queued
+ */
+boost::asio::awaitable<bool> FeedUpdater::downloadFeed() {
+  if (!fetcher_.has_value()) {
+    co_return false;
+  }
 
-  // Start an asynchronous event loop.
-  // This is required to start the request!
-  ios.run();
+  auto const start = clock::now();
+  auto result = co_await fetcher_->fetch();
+  if (!running_) {
+    co_return false;
+  }
+  pipeline_.metrics().fetch_.record(clock::now() - start);
+  if (result.status_ == tup::backend::upstream_fetcher::status::kError) {
+    std::cerr << "Fehler beim Aktualisieren des Feeds." << std::endl;
+    co_return false;
+  }
+  if (result.status_ == tup::backend::upstream_fetcher::status::kNotModified) {
+    co_return false;
+  }
 
-  transit_realtime::FeedMessage new_feed;
-  if (!new_feed.ParseFromString(protobuf_data)) return false;
-  // TODO: Make predictionMethod return updated feed and update feed afterwards to have atomic updates
-  predictionMethod_(new_feed);
-  return true;
+  pipeline_.push(std::move(result.body_));
+  co_return true;
 }
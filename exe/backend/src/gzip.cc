@@ -0,0 +1,59 @@
+#include "gzip.h"
+
+#include <array>
+#include <stdexcept>
+
+#include "boost/beast/zlib/deflate_stream.hpp"
+#include "boost/crc.hpp"
+
+namespace zlib = boost::beast::zlib;
+
+namespace tup::backend {
+
+  namespace {
+
+    void append_le32(std::string& out, std::uint32_t const value) {
+      for (auto i = 0; i != 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFFU));
+      }
+    }
+
+  }  // namespace
+
+  std::uint32_t crc32(std::string_view data) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data.data(), data.size());
+    return crc.checksum();
+  }
+
+  std::string gzip(std::string_view data) {
+    // member header: magic, deflate, no flags, no mtime, no extra flags, unix
+    constexpr auto kHeader = std::array<char, 10>{
+        '\x1f', '\x8b', '\x08', '\x00', '\x00', '\x00', '\x00', '\x00', '\x00', '\x03'};
+
+    zlib::deflate_stream stream;
+    stream.reset(6, 15, 8, zlib::Strategy::normal);
+
+    auto out = std::string{kHeader.data(), kHeader.size()};
+    auto const header_size = out.size();
+    out.resize(header_size + stream.upper_bound(data.size()));
+
+    zlib::z_params params;
+    params.next_in = data.data();
+    params.avail_in = data.size();
+    params.next_out = out.data() + header_size;
+    params.avail_out = out.size() - header_size;
+
+    boost::system::error_code ec;
+    stream.write(params, zlib::Flush::finish, ec);
+    if (ec && ec != zlib::error::end_of_stream) {
+      throw std::runtime_error{"gzip: " + ec.message()};
+    }
+    out.resize(header_size + params.total_out);
+
+    append_le32(out, crc32(data));
+    append_le32(out, static_cast<std::uint32_t>(data.size()));
+    return out;
+  }
+
+}  // namespace tup::backend
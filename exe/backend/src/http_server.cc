@@ -1,12 +1,22 @@
 #include "http_server.h"
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string_view>
 #include <utility>
 
 #include "boost/algorithm/string.hpp"
 #include "boost/asio/post.hpp"
+#include "boost/asio/steady_timer.hpp"
 #include "boost/json.hpp"
 #include <boost/beast/http.hpp>
 
+#include "fmt/format.h"
+
 #include "utl/pipes.h"
 #include "utl/to_vec.h"
 
@@ -16,6 +26,8 @@
 
 #include "geo/latlng.h"
 
+#include "prediction_pipeline.h"
+
 using namespace net;
 using net::web_server;
 
@@ -46,6 +58,168 @@ namespace tup::backend {
   }
 
 
+  std::string_view header_value(web_server::http_req_t const& req, http::field const field) {
+    auto const value = req[field];
+    return {value.data(), value.size()};
+  }
+
+  /**
+   * Splits a comma separated header value and calls f with every trimmed
+   * element until f returns true.
+   *
+   * @return whether f returned true for an element
+   */
+  template <typename Fn>
+  bool any_header_element(std::string_view value, Fn&& f) {
+    while (!value.empty()) {
+      auto const comma = value.find(',');
+      auto element = value.substr(0, comma);
+      value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+      while (!element.empty() && (element.front() == ' ' || element.front() == '\t')) {
+        element.remove_prefix(1);
+      }
+      while (!element.empty() && (element.back() == ' ' || element.back() == '\t')) {
+        element.remove_suffix(1);
+      }
+      if (!element.empty() && f(element)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Whether the Accept-Encoding header allows a gzip encoded response.
+  bool accepts_gzip(std::string_view const accept_encoding) {
+    return any_header_element(accept_encoding, [](std::string_view coding) {
+      auto const params = coding.find(';');
+      auto const name = coding.substr(0, params);
+      if (!boost::iequals(name, "gzip") && name != "*") {
+        return false;
+      }
+      if (params == std::string_view::npos) {
+        return true;
+      }
+      // "q=0", "q=0.0", ... explicitly refuse the coding
+      auto const q = coding.find("q=", params);
+      if (q == std::string_view::npos) {
+        return true;
+      }
+      auto weight = coding.substr(q + 2);
+      weight = weight.substr(0, weight.find_first_of("; \t"));
+      return weight.find_first_not_of("0.") != std::string_view::npos;
+    });
+  }
+
+  /// Whether the If-None-Match header lists the given entity tag.
+  bool etag_matches(std::string_view const if_none_match, std::string_view const etag) {
+    return any_header_element(if_none_match, [&](std::string_view tag) {
+      if (tag.starts_with("W/")) {
+        tag.remove_prefix(2);
+      }
+      return tag == "*" || tag == etag;
+    });
+  }
+
+  /// Returns the value of the query parameter name in the request target.
+  std::optional<std::string_view> query_param(std::string_view const target,
+                                              std::string_view const name) {
+    auto const question_mark = target.find('?');
+    if (question_mark == std::string_view::npos) {
+      return std::nullopt;
+    }
+    auto query = target.substr(question_mark + 1);
+    while (!query.empty()) {
+      auto const amp = query.find('&');
+      auto const param = query.substr(0, amp);
+      query = amp == std::string_view::npos ? std::string_view{} : query.substr(amp + 1);
+      auto const eq = param.find('=');
+      if (param.substr(0, eq) == name) {
+        return eq == std::string_view::npos ? std::string_view{} : param.substr(eq + 1);
+      }
+    }
+    return std::nullopt;
+  }
+
+  /// Parses an unsigned query parameter, nullopt if it is missing or malformed.
+  std::optional<std::uint64_t> query_uint(std::string_view const target,
+                                          std::string_view const name) {
+    auto const value = query_param(target, name);
+    if (!value.has_value()) {
+      return std::nullopt;
+    }
+    auto result = std::uint64_t{};
+    auto const [ptr, ec] = std::from_chars(value->data(), value->data() + value->size(), result);
+    if (ec != std::errc{} || ptr != value->data() + value->size()) {
+      return std::nullopt;
+    }
+    return result;
+  }
+
+  /// Decodes percent escapes and '+' in a query parameter value.
+  std::string url_decode(std::string_view const value) {
+    auto decoded = std::string{};
+    decoded.reserve(value.size());
+    for (auto i = 0U; i < value.size(); ++i) {
+      if (value[i] == '+') {
+        decoded.push_back(' ');
+      } else if (value[i] == '%' && i + 2 < value.size()) {
+        auto c = 0U;
+        auto const [ptr, ec] = std::from_chars(value.data() + i + 1, value.data() + i + 3, c, 16);
+        if (ec != std::errc{} || ptr != value.data() + i + 3) {
+          decoded.push_back(value[i]);
+          continue;
+        }
+        decoded.push_back(static_cast<char>(c));
+        i += 2;
+      } else {
+        decoded.push_back(value[i]);
+      }
+    }
+    return decoded;
+  }
+
+  /**
+   * Reads the trip_id, route_id, stop_id and bbox query parameters.
+   *
+   * @return the filter or nullopt if the bounding box is malformed
+   */
+  std::optional<feed_filter> parse_filter(std::string_view const target) {
+    auto filter = feed_filter{};
+    if (auto const trip_id = query_param(target, "trip_id"); trip_id.has_value()) {
+      filter.trip_id_ = url_decode(*trip_id);
+    }
+    if (auto const route_id = query_param(target, "route_id"); route_id.has_value()) {
+      filter.route_id_ = url_decode(*route_id);
+    }
+    if (auto const stop_id = query_param(target, "stop_id"); stop_id.has_value()) {
+      filter.stop_id_ = url_decode(*stop_id);
+    }
+    if (auto const bbox = query_param(target, "bbox"); bbox.has_value()) {
+      auto const decoded = url_decode(*bbox);
+      auto values = std::array<double, 4>{};
+      auto const* ptr = decoded.data();
+      auto const* const last = decoded.data() + decoded.size();
+      for (auto i = 0U; i != values.size(); ++i) {
+        if (i != 0U) {
+          if (ptr == last || *ptr != ',') {
+            return std::nullopt;
+          }
+          ++ptr;
+        }
+        auto const result = std::from_chars(ptr, last, values[i]);
+        if (result.ec != std::errc{}) {
+          return std::nullopt;
+        }
+        ptr = result.ptr;
+      }
+      if (ptr != last || values[0] > values[2] || values[1] > values[3]) {
+        return std::nullopt;
+      }
+      filter.bbox_ = values;
+    }
+    return filter;
+  }
+
   json::value to_json(std::vector<geo::latlng> const& polyline) {
     auto a = json::array{};
     for (auto const& p : polyline) {
@@ -58,11 +232,33 @@ namespace tup::backend {
     impl(boost::asio::io_context& ios,
         boost::asio::io_context& thread_pool,
         std::string const& static_file_path,
-        transit_realtime::FeedMessage& feed)
+        feed_publisher& publisher,
+        named_feeds feeds,
+        named_metrics metrics)
         : ioc_{ios},
           thread_pool_{thread_pool},
           server_{ioc_},
-          feed_(feed) {}
+          publisher_(publisher),
+          feeds_(std::move(feeds)),
+          metrics_(std::move(metrics)) {
+      auto publishers = std::vector<feed_publisher*>{&publisher_};
+      for (auto const& [name, p] : feeds_) {
+        if (std::find(begin(publishers), end(publishers), p) == end(publishers)) {
+          publishers.push_back(p);
+        }
+      }
+      for (auto* p : publishers) {
+        subscriptions_.emplace_back(p, p->subscribe([this, p](std::uint64_t) {
+          boost::asio::post(ioc_, [this, p] { answer_waiting(*p); });
+        }));
+      }
+    }
+
+    ~impl() {
+      for (auto const& [p, id] : subscriptions_) {
+        p->unsubscribe(id);
+      }
+    }
 
     void handle_request(web_server::http_req_t const& req,
                         web_server::http_res_cb_t const& cb) {
@@ -74,8 +270,12 @@ namespace tup::backend {
           if (target.starts_with("/api/test")) {
             return cb(json_response(req, R"({"message": "Test"})",
                                     http::status::ok));
+          } if (target == "/metrics") {
+            return handle_metrics(req, cb);
           } if (target.starts_with("/tripUpdates")) {
-            return handle_protobuf(req, cb);
+            if (auto* p = find_feed(req); p != nullptr) {
+              return handle_trip_updates(*p, req, cb);
+            }
           }
           return cb(json_response(req, R"({"error": "Not found"})",
                                   http::status::not_found));
@@ -100,17 +300,165 @@ namespace tup::backend {
           }
     }
 
-    /// Create an empty realtime feed with minimal required header values
-    void handle_protobuf(web_server::http_req_t const& request,
+    /// Serve the stage timings of all feeds in the Prometheus text format
+    void handle_metrics(web_server::http_req_t const& request,
+                        web_server::http_res_cb_t const& callback) {
+      namespace http = boost::beast::http;
+
+      auto out = std::string{};
+      auto const seconds = [](std::uint64_t const ns) { return static_cast<double>(ns) / 1e9; };
+      out += "# TYPE tup_stage_runs_total counter\n";
+      out += "# TYPE tup_stage_seconds_total counter\n";
+      out += "# TYPE tup_stage_last_seconds gauge\n";
+      for (auto const& [name, metrics] : metrics_) {
+        for (auto const& [stage, m] : {std::pair{"fetch", &metrics->fetch_},
+                                       std::pair{"parse", &metrics->parse_},
+                                       std::pair{"predict", &metrics->predict_},
+                                       std::pair{"publish", &metrics->publish_}}) {
+          auto const labels = fmt::format(R"({{feed="{}",stage="{}"}})", name, stage);
+          out += fmt::format("tup_stage_runs_total{} {}\n", labels, m->runs_.load());
+          out += fmt::format("tup_stage_seconds_total{} {}\n", labels, seconds(m->total_ns_.load()));
+          out += fmt::format("tup_stage_last_seconds{} {}\n", labels, seconds(m->last_ns_.load()));
+        }
+      }
+      out += "# TYPE tup_feeds_dropped_total counter\n";
+      out += "# TYPE tup_feeds_duplicate_total counter\n";
+      for (auto const& [name, metrics] : metrics_) {
+        out += fmt::format("tup_feeds_dropped_total{{feed=\"{}\"}} {}\n", name, metrics->dropped_.load());
+        out += fmt::format("tup_feeds_duplicate_total{{feed=\"{}\"}} {}\n", name, metrics->duplicates_.load());
+      }
+
+      http::response<http::string_body> res{http::status::ok, request.version()};
+      res.set(http::field::content_type, "text/plain; version=0.0.4");
+      res.body() = std::move(out);
+      res.prepare_payload();
+      callback(std::move(res));
+    }
+
+    /**
+     * Resolves /tripUpdates to the combined feed and /tripUpdates/<name> to
+     * the feed with that name.
+     *
+     * @return the feed or nullptr if the path names no feed
+     */
+    feed_publisher* find_feed(web_server::http_req_t const& request) {
+      auto const target = std::string_view{request.target().data(), request.target().size()};
+      auto path = target.substr(0, target.find('?'));
+      path.remove_prefix(std::string_view{"/tripUpdates"}.size());
+      if (path.empty() || path == "/") {
+        return &publisher_;
+      }
+      if (!path.starts_with('/')) {
+        return nullptr;
+      }
+      auto const it = feeds_.find(path.substr(1));
+      return it == end(feeds_) ? nullptr : it->second;
+    }
+
+    /**
+     * Serve the currently published trip updates feed from its cached encodings.
+     *
+     * With ?since=<version> only the changes since that version are sent as a
+     * DIFFERENTIAL feed. Adding &wait=<seconds> holds the request until a newer
+     * version is published (long polling) if the client is already up to date.
+     *
+     * Alternatively trip_id, route_id, stop_id and bbox=<min lat>,<min lng>,
+     * <max lat>,<max lng> select a part of the current feed. format=json
+     * returns JSON instead of protobuf.
+     */
+    void handle_trip_updates(feed_publisher& publisher,
+                      web_server::http_req_t const& request,
+                      web_server::http_res_cb_t const& callback) {
+      auto const target = std::string_view{request.target().data(), request.target().size()};
+      auto const since = query_uint(target, "since");
+      auto const wait = query_uint(target, "wait");
+      auto const filter = parse_filter(target);
+      if (!filter.has_value() || !filter->empty() || !since.has_value() ||
+          !wait.has_value() || *wait == 0U || *since != publisher.get()->version_) {
+        return respond_feed(publisher, request, callback);
+      }
+
+      auto const id = next_waiting_id_++;
+      auto& waiting = waiting_.emplace(id, waiting_request{&publisher, request, callback, *since,
+          boost::asio::steady_timer{ioc_}}).first->second;
+      waiting.timer_.expires_after(std::chrono::seconds{static_cast<std::int64_t>(std::min(*wait, kMaxWaitSeconds))});
+      waiting.timer_.async_wait([this, id](boost::system::error_code const& ec) {
+        // the request may have been answered by a publication in the meantime
+        auto const it = waiting_.find(id);
+        if (ec == boost::asio::error::operation_aborted || it == end(waiting_)) {
+          return;
+        }
+        auto* const publisher = it->second.publisher_;
+        auto const request = std::move(it->second.request_);
+        auto const callback = std::move(it->second.callback_);
+        waiting_.erase(it);
+        respond_feed(*publisher, request, callback);
+      });
+    }
+
+    /// Answer every held request for the feed that is behind its published version.
+    void answer_waiting(feed_publisher& publisher) {
+      auto const version = publisher.get()->version_;
+      for (auto it = begin(waiting_); it != end(waiting_);) {
+        if (it->second.publisher_ != &publisher || it->second.since_ == version) {
+          ++it;
+          continue;
+        }
+        it->second.timer_.cancel();
+        respond_feed(publisher, it->second.request_, it->second.callback_);
+        it = waiting_.erase(it);
+      }
+    }
+
+    void respond_feed(feed_publisher& publisher,
+                      web_server::http_req_t const& request,
                       web_server::http_res_cb_t const& callback) {
       namespace http = boost::beast::http;
-  
-      std::string serialized_feed;
-      feed_.SerializeToString(&serialized_feed);
+
+      auto const target = std::string_view{request.target().data(), request.target().size()};
+      auto const since = query_uint(target, "since");
+      auto const filter = parse_filter(target);
+      if (!filter.has_value()) {
+        return callback(json_response(request, R"({"error": "Invalid bbox"})",
+                                      http::status::bad_request));
+      }
+      if (!filter->empty() && since.has_value()) {
+        return callback(json_response(request, R"({"error": "Filters cannot be combined with since"})",
+                                      http::status::bad_request));
+      }
+
+      auto snapshot = std::shared_ptr<feed_snapshot const>{};
+      if (!filter->empty()) {
+        snapshot = publisher.get_filtered(*filter);
+      } else if (since.has_value()) {
+        snapshot = publisher.get_changes_since(*since);
+      }
+      if (snapshot == nullptr) {
+        // unknown or expired version, the client has to start over
+        snapshot = publisher.get();
+      }
+      auto const as_json = query_param(target, "format") == "json";
+      auto const& encoded = as_json ? snapshot->json() : snapshot->protobuf_;
+
+      if (etag_matches(header_value(request, http::field::if_none_match), encoded.etag_)) {
+        http::response<http::string_body> res{http::status::not_modified, request.version()};
+        res.set(http::field::etag, encoded.etag_);
+        res.set(http::field::vary, "Accept-Encoding");
+        res.set("X-Feed-Version", std::to_string(snapshot->version_));
+        return callback(std::move(res));
+      }
 
       http::response<http::string_body> res{http::status::ok, request.version()};
-      res.set(http::field::content_type, "application/x-protobuf");
-      res.body() = std::move(serialized_feed);
+      res.set(http::field::content_type, as_json ? "application/json" : "application/x-protobuf");
+      res.set(http::field::etag, encoded.etag_);
+      res.set(http::field::vary, "Accept-Encoding");
+      res.set("X-Feed-Version", std::to_string(snapshot->version_));
+      if (accepts_gzip(header_value(request, http::field::accept_encoding))) {
+        res.set(http::field::content_encoding, "gzip");
+        res.body() = encoded.gzipped_;
+      } else {
+        res.body() = encoded.body_;
+      }
       res.prepare_payload();
 
       callback(std::move(res));
@@ -145,14 +493,32 @@ namespace tup::backend {
       web_server server_;
       bool serve_static_files_{false};
       std::string static_file_path_;
-      transit_realtime::FeedMessage& feed_;
+      feed_publisher& publisher_;
+      named_feeds feeds_;
+      named_metrics metrics_;
+      std::vector<std::pair<feed_publisher*, std::uint64_t>> subscriptions_;
+
+      /// Requests held until the next publication or their timeout.
+      struct waiting_request {
+        feed_publisher* publisher_;
+        web_server::http_req_t request_;
+        web_server::http_res_cb_t callback_;
+        std::uint64_t since_;
+        boost::asio::steady_timer timer_;
+      };
+      static constexpr std::uint64_t kMaxWaitSeconds = 30U;
+      std::map<std::uint64_t, waiting_request> waiting_;
+      std::uint64_t next_waiting_id_{0U};
   };
 
   http_server::http_server(boost::asio::io_context& ioc,
                           boost::asio::io_context& thread_pool,
                           std::string const& static_file_path,
-                          transit_realtime::FeedMessage& feed)
-    : impl_(new impl(ioc, thread_pool, static_file_path, feed)) {}
+                          feed_publisher& publisher,
+                          named_feeds feeds,
+                          named_metrics metrics)
+    : impl_(new impl(ioc, thread_pool, static_file_path, publisher, std::move(feeds),
+                     std::move(metrics))) {}
 
   http_server::~http_server() = default;
 
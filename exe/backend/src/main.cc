@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <filesystem>
 #include <thread>
@@ -9,13 +11,24 @@
 #include "net/http/client/https_client.h"
 
 #include "http_server.h"
+#include "feed_combiner.h"
+#include "feed_config.h"
 #include "feed_updater.h"
+#include "prediction_pipeline.h"
+#include "timetable_snapshot.h"
 
 #include "predictors/simple-predictor.h"
 #include "predictors/gtfs-position-tracker.h"
 #include "predictors/schedule-based-predictor.h"
 #include "predictors/historic-average-predictor.h"
-
+#include "predictors/feed-builder.h"
+#include "predictors/prediction-context.h"
+#include "predictors/route-geometry-cache.h"
+#include "predictors/trip-index.h"
+
+#include <memory>
+#include <optional>
+#include <unordered_map>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
@@ -31,6 +44,8 @@
 
 #include "utl/progress_tracker.h"
 
+#include "tbb/task_arena.h"
+
 #include "nigiri/loader/load.h"
 #include "nigiri/loader/loader_interface.h"
 #include "nigiri/common/parse_date.h"
@@ -60,6 +75,114 @@ auto run(boost::asio::io_context& ioc) {
   };
 }
 
+/// Everything needed to turn one upstream vehicle positions feed into trip updates
+struct feed_pipeline {
+  feed_pipeline(feed_config config,
+                timetable const& tt,
+                std::optional<source_idx_t> const source,
+                RouteGeometryCache const& routes,
+                stop_locator locate_stop)
+      : config_(std::move(config)),
+        trips_(tt, source),
+        context_{tt, trips_, routes},
+        publisher_(std::move(locate_stop)) {}
+
+  feed_config config_;
+  TripIndex trips_;
+  PredictionContext context_;
+  FeedBuilder builder_;
+  HistoricAveragePredictor historic_;
+  feed_publisher publisher_;
+  prediction_pipeline::prediction_method method_;
+  std::unique_ptr<prediction_pipeline> pipeline_;
+  std::unique_ptr<FeedUpdater> updater_;
+};
+
+/**
+ * Loads the recorded trip updates (*.pb) from the directory into the store of
+ * the historic predictor.
+ */
+void load_historic_data(HistoricAveragePredictor& historic_average_predictor,
+                        PredictionContext const& context,
+                        fs::path const& pin) {
+  if (!exists(pin) || !is_directory(pin)) {
+    return;
+  }
+  for (const auto& entry : fs::directory_iterator(pin)) {
+    std::cout << "Trying to parse feed from file: " << entry.path() << std::endl;
+    if (entry.path().extension() == ".pb") {
+      std::ifstream input(entry.path(), std::ios::binary);
+      if (!input) {
+        continue;
+      }
+      std::string buffer(std::istreambuf_iterator<char>(input), {});
+      transit_realtime::FeedMessage feed;
+      if (!feed.ParseFromString(buffer)) {
+        continue;
+      }
+      std::vector<stopTime> stopTimes;
+      for (const auto& entity : feed.entity()) {
+        if (entity.has_trip_update()) {
+          const auto& trip = entity.trip_update();
+          for (const auto& update : trip.stop_time_update()) {
+            if (update.has_arrival()) {
+              stopTime stopTime = {trip.trip().trip_id(), update.stop_id(),
+                   date::format("%F",
+                                date::floor<date::days>(
+                                    std::chrono::system_clock::time_point(
+                                        std::chrono::seconds(
+                                            update.arrival().time())))),
+                update.arrival().time() % 86400};
+              stopTimes.push_back(stopTime);
+            }
+          }
+        }
+      }
+      historic_average_predictor.loadHistoricData(stopTimes, context);
+    }
+  }
+}
+
+/**
+ * Sets the prediction method of the feed according to its predictor.
+ * @return false if the predictor is unknown
+ */
+bool set_prediction_method(feed_pipeline& feed, tbb::task_arena& prediction_arena) {
+  auto const& predictor = feed.config_.predictor_;
+  if (predictor == "gtfs-position-tracker") {
+    feed.method_ = [&](const transit_realtime::FeedMessage& vehiclePositions) {
+      return prediction_arena.execute([&] {
+        GTFSPositionTracker::predict(feed.builder_, vehiclePositions, feed.context_);
+        return feed.builder_.build();
+      });
+    };
+  } else if (predictor == "schedule-based") {
+    feed.method_ = [&](const transit_realtime::FeedMessage& vehiclePositions) {
+      return prediction_arena.execute([&] {
+        ScheduleBasedPredictor::predict(feed.builder_, vehiclePositions, feed.context_);
+        return feed.builder_.build();
+      });
+    };
+  } else if (predictor == "dummy") {
+    feed.method_ = [&](transit_realtime::FeedMessage& vehiclePositions) {
+      SimplePredictor simple_predictor(std::chrono::milliseconds(5000), false);
+      simple_predictor.predict(vehiclePositions);
+      return vehiclePositions;
+        };
+  } else if (predictor == "historic") {
+    load_historic_data(feed.historic_, feed.context_, feed.config_.history_);
+    feed.method_ = [&](const transit_realtime::FeedMessage& vehiclePositions) {
+      return prediction_arena.execute([&] {
+        feed.historic_.predict(feed.builder_, vehiclePositions, feed.context_);
+        return feed.builder_.build();
+      });
+    };
+  } else {
+    return false;
+  }
+  return true;
+}
+
 size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
   static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
   return size * nmemb;
@@ -76,6 +199,7 @@ int main(int argc, char const* argv[]) {
   auto http_port = "8000"s;
   auto static_file_path = fs::path{};
   unsigned threads_ = std::thread::hardware_concurrency();
+  unsigned prediction_threads = std::thread::hardware_concurrency();
   bool lock = true;
 
   std::string vehicle_position_url;
@@ -89,6 +213,7 @@ int main(int argc, char const* argv[]) {
   auto n_days = 365U;
   auto recursive = false;
   auto ignore = false;
+  auto snapshot = false;
 
   auto finalize_opt = finalize_options{};
   auto c = loader_config{};
@@ -98,15 +223,19 @@ int main(int argc, char const* argv[]) {
   desc.add_options()  //
       ("help,h", "produce this help message")  //
 
-      ("config,c", bpo::value(&config_file)->default_value(config_file), "config file path")  //
+      ("config,c", bpo::value(&config_file)->default_value(config_file),
+       "config file listing the vehicle positions feeds")  //
       ("data,d", bpo::value(&data_dir)->default_value(data_dir), "data directory")  //
       ("host", bpo::value(&http_host)->default_value(http_host), "HTTP host")  //
       ("port,p", bpo::value(&http_port)->default_value(http_port), "HTTP port")  //
       ("static", bpo::value(&static_file_path)->default_value(static_file_path), "Path to static files (ui/web)")  //
       ("threads,t", bpo::value(&threads_)->default_value(threads_), "Number of routing threads")  //
       ("lock,l", bpo::bool_switch(&lock)->default_value(lock), "Lock to memory")  //
+      ("prediction_threads", bpo::value(&prediction_threads)->default_value(prediction_threads),
+       "Number of threads used to match vehicles and predict arrivals")  //
 
-      ("vehicle_positions_url,v", bpo::value(&vehicle_position_url)->required(), "URL for vehicle positions")  //
+      ("vehicle_positions_url,v", bpo::value(&vehicle_position_url),
+       "URL for vehicle positions, if not set the feeds are read from the config file")  //
       ("predictor,P", bpo::value(&predictor)->default_value("gtfs-position-tracker"), "Choose which predictor to use")
       ("in,i", bpo::value(&in)->required(), "input path")  //
       ("protobuf_input,pi", bpo::value(&pin)->default_value("protobuf"), "input path")  //
@@ -115,6 +244,9 @@ int main(int argc, char const* argv[]) {
       ("ignore", bpo::bool_switch(&ignore)->default_value(false),
        "ignore if a directory entry is not a timetable (only for recursive)")  //
       ("out,o", bpo::value(&out)->default_value(out), "output file path")  //
+      ("snapshot", bpo::bool_switch(&snapshot)->default_value(false),
+       "write the timetable to the output file after importing and memory-map it "
+       "on later starts as long as the input has not changed")  //
       ("start_date,s", bpo::value(&start_date)->default_value(start_date),
        "start date of the timetable, format: YYYY-MM-DD")  //
       ("num_days,n", bpo::value(&n_days)->default_value(n_days),
@@ -178,16 +310,57 @@ int main(int argc, char const* argv[]) {
     assistance = std::make_unique<assistance_times>(read_assistance(f.view()));
   }
 
+  auto const settings = fmt::format(
+      "start_date={} num_days={} merge_dupes_intra_source={} "
+      "merge_dupes_inter_source={} adjust_footpaths={} max_footpath_length={} "
+      "assistance_times={} shapes={} ignore={}",
+      start_date, n_days, finalize_opt.merge_dupes_intra_src_,
+      finalize_opt.merge_dupes_inter_src_, finalize_opt.adjust_footpaths_,
+      finalize_opt.max_footpath_length_, assistance_path.generic_string(),
+      vm.contains("shapes") ? out_shapes.generic_string() : "", ignore && recursive);
+  auto const fingerprint = timetable_fingerprint(input_files, settings);
+  auto const use_snapshot = snapshot && is_snapshot_valid(out, fingerprint);
+
   auto shapes = std::unique_ptr<shapes_storage>{};
   if (vm.contains("shapes")) {
-    shapes = std::make_unique<shapes_storage>(out_shapes,
-                                              cista::mmap::protection::WRITE);
+    shapes = std::make_unique<shapes_storage>(
+        out_shapes, use_snapshot ? cista::mmap::protection::READ
+                                 : cista::mmap::protection::WRITE);
   }
 
-  auto const start = parse_date(start_date);
-  auto timetable = load(input_files, finalize_opt, {start, start + date::days{n_days}},
-       assistance.get(), shapes.get(), ignore && recursive);
+  auto tt = cista::wrapped<nigiri::timetable>{};
+  if (use_snapshot) {
+    std::cout << "Loading timetable snapshot from " << out << std::endl;
+    tt = nigiri::timetable::read(out);
+  } else {
+    auto const start = parse_date(start_date);
+    tt = cista::wrapped{cista::raw::make_unique<nigiri::timetable>(
+        load(input_files, finalize_opt, {start, start + date::days{n_days}},
+             assistance.get(), shapes.get(), ignore && recursive))};
+    if (snapshot) {
+      write_snapshot(*tt, out, fingerprint);
+    }
+  }
+  auto const& timetable = *tt;
 
+  auto feed_configs = std::vector<feed_config>{};
+  if (!vehicle_position_url.empty()) {
+    feed_configs.push_back({.name_ = "default", .url_ = vehicle_position_url,
+                            .dataset_ = {}, .predictor_ = predictor, .history_ = pin});
+  } else {
+    try {
+      feed_configs = read_feed_config(config_file, predictor, pin);
+    } catch (std::exception const& e) {
+      std::cerr << "Could not read config: " << e.what() << "\n";
+      return 1;
+    }
+  }
+  if (feed_configs.empty()) {
+    std::cerr << "no vehicle positions feed configured\n";
+    return 1;
+  }
+
+  auto const route_geometry = RouteGeometryCache{timetable};
 
   auto ioc = boost::asio::io_context{};
   auto pool = boost::asio::io_context{};
@@ -198,90 +371,84 @@ int main(int argc, char const* argv[]) {
     t = std::thread(run(pool));
   }
 
-  
-  auto tripUpdatesFeed = transit_realtime::FeedMessage{};
-  transit_realtime::FeedHeader* header = tripUpdatesFeed.mutable_header();
-  FeedUpdater::PredictionMethod method;
-  header->set_gtfs_realtime_version("2.0");
-  header->set_incrementality(transit_realtime::FeedHeader_Incrementality_FULL_DATASET);
-  header->set_timestamp(time(nullptr));
-  auto historic_average_predictor = HistoricAveragePredictor();
-  if (predictor == "gtfs-position-tracker") {
-    method = [&](const transit_realtime::FeedMessage& vehiclePositions) {
-      GTFSPositionTracker::predict(tripUpdatesFeed, vehiclePositions, timetable);
-    };
-  } else if (predictor == "schedule-based") {
-    method = [&](const transit_realtime::FeedMessage& vehiclePositions) {
-      ScheduleBasedPredictor::predict(tripUpdatesFeed, vehiclePositions, timetable);
-    };
-  } else if (predictor == "dummy") {
-    method = [&](transit_realtime::FeedMessage& vehiclePositions) {
-      SimplePredictor simple_predictor(std::chrono::milliseconds(5000), false);
-      simple_predictor.predict(vehiclePositions);
-        };
-  } else if (predictor == "historic") {
-    if (exists(pin) && is_directory(pin)) {
-      for (const auto& entry : fs::directory_iterator(pin)) {
-        std::cout << "Trying to parse feed from file: " << entry.path() << std::endl;
-        if (entry.path().extension() == ".pb") {
-          std::ifstream input(entry.path(), std::ios::binary);
-          if (!input) {
-            continue;
-          }
-          std::string buffer(std::istreambuf_iterator<char>(input), {});
-          transit_realtime::FeedMessage feed;
-          if (!feed.ParseFromString(buffer)) {
-            continue;
-          }
-          std::vector<stopTime> stopTimes;
-          for (const auto& entity : feed.entity()) {
-            if (entity.has_trip_update()) {
-              const auto& trip = entity.trip_update();
-              for (const auto& update : trip.stop_time_update()) {
-                if (update.has_arrival()) {
-                  stopTime stopTime = {trip.trip().trip_id(), update.stop_id(),
-                       date::format("%F",
-                                    date::floor<date::days>(
-                                        std::chrono::system_clock::time_point(
-                                            std::chrono::seconds(
-                                                update.arrival().time())))),
-                    update.arrival().time() % 86400};
-                  stopTimes.push_back(stopTime);
-                }
-              }
-            }
-          }
-          historic_average_predictor.loadHistoricData(stopTimes);
-        }
+  auto stop_positions = std::unordered_map<std::string_view, geo::latlng>{};
+  stop_positions.reserve(timetable.n_locations());
+  for (auto l = location_idx_t{0U}; l != timetable.n_locations(); ++l) {
+    stop_positions.emplace(timetable.locations_.ids_[l].view(), timetable.locations_.coordinates_[l]);
+  }
+  auto const locate_stop = stop_locator{[&](std::string_view stop_id) -> std::optional<geo::latlng> {
+    auto const it = stop_positions.find(stop_id);
+    return it == end(stop_positions) ? std::nullopt : std::optional{it->second};
+  }};
+
+  // all feeds share the timetable, the lookup tables and the prediction threads
+  auto prediction_arena = tbb::task_arena{static_cast<int>(std::max(1U, prediction_threads))};
+  auto feeds = std::vector<std::unique_ptr<feed_pipeline>>{};
+  for (auto& config : feed_configs) {
+    auto source = std::optional<source_idx_t>{};
+    if (!config.dataset_.empty()) {
+      auto const it = std::find_if(begin(input_files), end(input_files), [&](auto const& input) {
+        return input.first == config.dataset_ ||
+               fs::path{input.first}.filename() == fs::path{config.dataset_}.filename();
+      });
+      if (it == end(input_files)) {
+        std::cerr << "feed " << config.name_ << ": unknown dataset " << config.dataset_ << "\n";
+        return 1;
       }
+      // nigiri numbers the sources in the order of the input files
+      source = source_idx_t{static_cast<source_idx_t::value_t>(std::distance(begin(input_files), it))};
+    }
+    auto& feed = *feeds.emplace_back(std::make_unique<feed_pipeline>(
+        std::move(config), timetable, source, route_geometry, locate_stop));
+    if (!set_prediction_method(feed, prediction_arena)) {
+      std::cout << "No valid predictor chosen for feed " << feed.config_.name_ << "!" << std::endl;
+      return 1;
     }
-    method = [&](const transit_realtime::FeedMessage& vehiclePositions) {
-      historic_average_predictor.predict(tripUpdatesFeed, vehiclePositions, timetable);
-    };
-  } else {
-    std::cout << "No valid predictor chosen!" << std::endl;
-    return 1;
   }
 
+  // with several feeds /tripUpdates serves their union
+  auto named = named_feeds{};
+  auto sources = std::vector<std::pair<std::string, feed_publisher*>>{};
+  for (auto const& feed : feeds) {
+    named.emplace(feed->config_.name_, &feed->publisher_);
+    sources.emplace_back(feed->config_.name_, &feed->publisher_);
+  }
+  auto combined_publisher = feed_publisher{locate_stop};
+  auto combiner = std::unique_ptr<feed_combiner>{};
+  if (feeds.size() > 1U) {
+    combiner = std::make_unique<feed_combiner>(std::move(sources), combined_publisher);
+  }
+  auto& publisher = feeds.size() > 1U ? combined_publisher : feeds.front()->publisher_;
+
+  // Fetch the feeds continuously on the thread pool, predict and publish them in pipelines
+  auto metrics = named_metrics{};
+  for (auto& feed : feeds) {
+    feed->pipeline_ = std::make_unique<prediction_pipeline>(prediction_arena, feed->method_, feed->publisher_);
+    feed->updater_ = std::make_unique<FeedUpdater>(pool, feed->config_.url_, *feed->pipeline_);
+    feed->updater_->start();
+    metrics.emplace(feed->config_.name_, &feed->pipeline_->metrics());
+  }
+  auto const stop_updaters = [&]() {
+    for (auto& feed : feeds) {
+      feed->updater_->stop();
+      feed->pipeline_->stop();
+    }
+  };
 
-  // Spawn a new thread that fetches the feed and updates the output feed accordingly continuously
-  FeedUpdater feedUpdater(tripUpdatesFeed, vehicle_position_url, method);
-  feedUpdater.start();
-  
-  auto server = http_server{ioc, pool, static_file_path, feedUpdater.getFeed()};
+  auto server = http_server{ioc, pool, static_file_path, publisher, std::move(named), std::move(metrics)};
 
   server.listen(http_host, http_port);
 
   auto const stop = net::stop_handler(ioc, [&]() {
-    feedUpdater.stop();
+    stop_updaters();
     server.stop();
     ioc.stop();
   });
 
   ioc.run();
+  stop_updaters();
   pool.stop();
   for (auto& t : threads) {
     t.join();
   }
-  feedUpdater.stop();
 }
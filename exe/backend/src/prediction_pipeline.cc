@@ -0,0 +1,159 @@
+#include "prediction_pipeline.h"
+
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include "tbb/parallel_pipeline.h"
+
+namespace tup::backend {
+
+  namespace {
+
+    /// A feed on its way through the pipeline.
+    struct cycle {
+      std::string raw_;
+      transit_realtime::FeedMessage vehicle_positions_;
+      transit_realtime::FeedMessage trip_updates_;
+    };
+
+    template <typename Fn>
+    auto timed(stage_metrics& metrics, Fn&& fn) {
+      auto const start = std::chrono::steady_clock::now();
+      if constexpr (std::is_void_v<decltype(fn())>) {
+        fn();
+        metrics.record(std::chrono::steady_clock::now() - start);
+      } else {
+        auto result = fn();
+        metrics.record(std::chrono::steady_clock::now() - start);
+        return result;
+      }
+    }
+
+  }  // namespace
+
+  void stage_metrics::record(std::chrono::steady_clock::duration const d) {
+    auto const ns = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    runs_.fetch_add(1U, std::memory_order_relaxed);
+    total_ns_.fetch_add(ns, std::memory_order_relaxed);
+    last_ns_.store(ns, std::memory_order_relaxed);
+  }
+
+  prediction_pipeline::prediction_pipeline(tbb::task_arena& arena,
+                                           prediction_method& predict,
+                                           feed_publisher& publisher)
+      : arena_(arena), predict_(predict), publisher_(publisher), thread_([this] { run(); }) {}
+
+  prediction_pipeline::~prediction_pipeline() {
+    stop();
+  }
+
+  pipeline_metrics& prediction_pipeline::metrics() {
+    return metrics_;
+  }
+
+  void prediction_pipeline::push(std::string&& raw_feed) {
+    {
+      auto const lock = std::scoped_lock{mutex_};
+      if (queue_.size() >= kQueueSize) {
+        queue_.pop_front();
+        metrics_.dropped_.fetch_add(1U, std::memory_order_relaxed);
+      }
+      queue_.push_back(std::move(raw_feed));
+    }
+    ready_.notify_one();
+  }
+
+  void prediction_pipeline::stop() {
+    {
+      auto const lock = std::scoped_lock{mutex_};
+      stopping_ = true;
+      queue_.clear();
+    }
+    ready_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  std::optional<std::string> prediction_pipeline::try_pop() {
+    auto const lock = std::scoped_lock{mutex_};
+    if (stopping_ || queue_.empty()) {
+      return std::nullopt;
+    }
+    auto raw = std::move(queue_.front());
+    queue_.pop_front();
+    return raw;
+  }
+
+  /**
+   * Waits for fetched feeds outside of TBB and runs the pipeline as long as
+   * feeds are queued, so that no TBB worker blocks on an empty queue.
+   */
+  void prediction_pipeline::run() {
+    while (true) {
+      {
+        auto lock = std::unique_lock{mutex_};
+        ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (stopping_) {
+          return;
+        }
+      }
+
+      arena_.execute([&] {
+        tbb::parallel_pipeline(
+            kLiveTokens,
+            tbb::make_filter<void, std::shared_ptr<cycle>>(
+                tbb::filter_mode::serial_in_order,
+                [&](tbb::flow_control& fc) -> std::shared_ptr<cycle> {
+                  auto raw = try_pop();
+                  if (!raw.has_value()) {
+                    fc.stop();
+                    return nullptr;
+                  }
+                  auto c = std::make_shared<cycle>();
+                  c->raw_ = std::move(*raw);
+                  return c;
+                }) &
+            tbb::make_filter<std::shared_ptr<cycle>, std::shared_ptr<cycle>>(
+                tbb::filter_mode::serial_in_order,
+                [&](std::shared_ptr<cycle> c) -> std::shared_ptr<cycle> {
+                  return timed(metrics_.parse_, [&]() -> std::shared_ptr<cycle> {
+                    if (!c->vehicle_positions_.ParseFromString(c->raw_)) {
+                      std::cerr << "Fehler beim Aktualisieren des Feeds." << std::endl;
+                      return nullptr;
+                    }
+                    // some servers regenerate the bytes without new data
+                    auto const& header = c->vehicle_positions_.header();
+                    if (header.has_timestamp() && header.timestamp() == lastFeedTimestamp_) {
+                      metrics_.duplicates_.fetch_add(1U, std::memory_order_relaxed);
+                      return nullptr;
+                    }
+                    lastFeedTimestamp_ = header.timestamp();
+                    c->raw_ = {};
+                    return c;
+                  });
+                }) &
+            tbb::make_filter<std::shared_ptr<cycle>, std::shared_ptr<cycle>>(
+                tbb::filter_mode::serial_in_order,
+                [&](std::shared_ptr<cycle> c) -> std::shared_ptr<cycle> {
+                  if (c == nullptr) {
+                    return nullptr;
+                  }
+                  timed(metrics_.predict_, [&] { c->trip_updates_ = predict_(c->vehicle_positions_); });
+                  return c;
+                }) &
+            tbb::make_filter<std::shared_ptr<cycle>, void>(
+                tbb::filter_mode::serial_in_order,
+                [&](std::shared_ptr<cycle> c) {
+                  if (c == nullptr) {
+                    return;
+                  }
+                  timed(metrics_.publish_, [&] { publisher_.publish(std::move(c->trip_updates_)); });
+                }));
+      });
+    }
+  }
+
+}  // namespace tup::backend
@@ -0,0 +1,78 @@
+#include "timetable_snapshot.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace tup::backend {
+
+  namespace {
+
+    fs::path meta_path(fs::path const& tt_path) {
+      return fs::path{tt_path}.concat(".meta");
+    }
+
+    void describe_file(std::ostream& out, fs::path const& p) {
+      out << p.generic_string() << ' ' << fs::file_size(p) << ' '
+          << fs::last_write_time(p).time_since_epoch().count() << '\n';
+    }
+
+  }  // namespace
+
+  std::string timetable_fingerprint(
+      std::vector<std::pair<std::string, nigiri::loader::loader_config>> const& input_files,
+      std::string const& settings) {
+    std::ostringstream out;
+    out << settings << '\n';
+    for (auto const& [path, config] : input_files) {
+      out << path << ' ' << config.default_tz_ << ' '
+          << config.link_stop_distance_ << '\n';
+      if (fs::is_directory(path)) {
+        // directory iteration order is unspecified, sort to get a stable result
+        auto files = std::vector<fs::path>{};
+        for (auto const& e : fs::recursive_directory_iterator(path)) {
+          if (e.is_regular_file()) {
+            files.push_back(e.path());
+          }
+        }
+        std::ranges::sort(files);
+        for (auto const& f : files) {
+          describe_file(out, f);
+        }
+      } else {
+        describe_file(out, path);
+      }
+    }
+    return out.str();
+  }
+
+  bool is_snapshot_valid(fs::path const& tt_path, std::string const& fingerprint) {
+    if (!fs::exists(tt_path) || !fs::exists(meta_path(tt_path))) {
+      return false;
+    }
+    std::ifstream in{meta_path(tt_path), std::ios::binary};
+    std::string const stored{std::istreambuf_iterator<char>(in), {}};
+    return stored == fingerprint;
+  }
+
+  void write_snapshot(nigiri::timetable const& timetable,
+                      fs::path const& tt_path,
+                      std::string const& fingerprint) {
+    // The fingerprint is written last: a crash while writing tt.bin leaves
+    // no valid meta file behind and the next start imports again.
+    fs::remove(meta_path(tt_path));
+    timetable.write(tt_path);
+
+    auto const tmp = fs::path{meta_path(tt_path)}.concat(".tmp");
+    {
+      std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+      out << fingerprint;
+    }
+    fs::rename(tmp, meta_path(tt_path));
+    std::cout << "Wrote timetable snapshot to " << tt_path << std::endl;
+  }
+
+}  // namespace tup::backend
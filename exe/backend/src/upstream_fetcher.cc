@@ -0,0 +1,219 @@
+#include "upstream_fetcher.h"
+
+#include <functional>
+#include <iostream>
+#include <utility>
+
+#include "boost/asio/connect.hpp"
+#include "boost/asio/redirect_error.hpp"
+#include "boost/asio/ssl/error.hpp"
+#include "boost/asio/use_awaitable.hpp"
+#include "boost/beast/http.hpp"
+#include "boost/beast/ssl.hpp"
+#include "boost/beast/version.hpp"
+
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace ssl = boost::asio::ssl;
+using tcp = boost::asio::ip::tcp;
+
+namespace tup::backend {
+
+  std::optional<url> url::parse(std::string_view str) {
+    auto result = url{};
+    if (str.starts_with("https://")) {
+      result.https_ = true;
+      str.remove_prefix(8);
+    } else if (str.starts_with("http://")) {
+      result.https_ = false;
+      str.remove_prefix(7);
+    } else {
+      return std::nullopt;
+    }
+
+    auto const path_start = str.find_first_of("/?");
+    auto const authority = str.substr(0, path_start);
+    result.target_ = path_start == std::string_view::npos ? "/" : std::string{str.substr(path_start)};
+    if (result.target_.starts_with('?')) {
+      result.target_.insert(0, "/");
+    }
+
+    auto const colon = authority.rfind(':');
+    if (colon != std::string_view::npos && authority.find(']', colon) == std::string_view::npos) {
+      result.host_ = authority.substr(0, colon);
+      result.port_ = authority.substr(colon + 1);
+    } else {
+      result.host_ = authority;
+      result.port_ = result.https_ ? "443" : "80";
+    }
+    if (result.host_.empty() || result.port_.empty()) {
+      return std::nullopt;
+    }
+    return result;
+  }
+
+  namespace {
+
+    /// Sends the request and reads the response on an established connection.
+    template <typename Stream>
+    boost::asio::awaitable<boost::system::error_code> exchange(
+        Stream& stream,
+        http::request<http::empty_body> const& req,
+        beast::flat_buffer& buffer,
+        http::response<http::string_body>& res) {
+      auto ec = boost::system::error_code{};
+      co_await http::async_write(stream, req, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      if (!ec) {
+        co_await http::async_read(stream, buffer, res,
+                                  boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+      }
+      co_return ec;
+    }
+
+  }  // namespace
+
+  upstream_fetcher::upstream_fetcher(boost::asio::any_io_executor executor,
+                                     url target,
+                                     std::chrono::seconds timeout)
+      : executor_(std::move(executor)),
+        target_(std::move(target)),
+        timeout_(timeout),
+        resolver_(executor_),
+        ssl_ctx_(ssl::context::tlsv12_client) {
+    // same as the previous client: the runtime image ships without CA certificates
+    ssl_ctx_.set_verify_mode(ssl::verify_none);
+  }
+
+  beast::tcp_stream& upstream_fetcher::tcp() {
+    if (auto* s = std::get_if<beast::ssl_stream<beast::tcp_stream>>(&stream_)) {
+      return beast::get_lowest_layer(*s);
+    }
+    return std::get<beast::tcp_stream>(stream_);
+  }
+
+  boost::asio::awaitable<boost::system::error_code> upstream_fetcher::connect() {
+    auto ec = boost::system::error_code{};
+    auto const endpoints = co_await resolver_.async_resolve(
+        target_.host_, target_.port_, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      co_return ec;
+    }
+    if (cancelled_) {
+      co_return boost::asio::error::operation_aborted;
+    }
+
+    if (target_.https_) {
+      auto& s = stream_.emplace<beast::ssl_stream<beast::tcp_stream>>(executor_, ssl_ctx_);
+      if (!SSL_set_tlsext_host_name(s.native_handle(), target_.host_.c_str())) {
+        co_return boost::system::error_code{static_cast<int>(::ERR_get_error()),
+                                            boost::asio::error::get_ssl_category()};
+      }
+    } else {
+      stream_.emplace<beast::tcp_stream>(executor_);
+    }
+
+    tcp().expires_after(timeout_);
+    co_await tcp().async_connect(endpoints, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      co_return ec;
+    }
+    if (auto* s = std::get_if<beast::ssl_stream<beast::tcp_stream>>(&stream_)) {
+      tcp().expires_after(timeout_);
+      co_await s->async_handshake(ssl::stream_base::client,
+                                  boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
+    co_return ec;
+  }
+
+  void upstream_fetcher::disconnect() {
+    if (!std::holds_alternative<std::monostate>(stream_)) {
+      auto ec = boost::system::error_code{};
+      tcp().socket().shutdown(tcp::socket::shutdown_both, ec);
+      tcp().close();
+    }
+    stream_.emplace<std::monostate>();
+    buffer_.clear();
+  }
+
+  void upstream_fetcher::cancel() {
+    cancelled_ = true;
+    resolver_.cancel();
+    if (!std::holds_alternative<std::monostate>(stream_)) {
+      // pending operations complete with operation_aborted, the coroutine
+      // still refers to the stream, so it is destroyed there
+      tcp().close();
+    }
+  }
+
+  boost::asio::awaitable<upstream_fetcher::result> upstream_fetcher::fetch() {
+    auto req = http::request<http::empty_body>{http::verb::get, target_.target_, 11};
+    req.set(http::field::host, target_.host_);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.keep_alive(true);
+    if (!etag_.empty()) {
+      req.set(http::field::if_none_match, etag_);
+    }
+    if (!last_modified_.empty()) {
+      req.set(http::field::if_modified_since, last_modified_);
+    }
+
+    // a kept-alive connection may have been closed by the server in the
+    // meantime, so a failure on a reused connection is retried once
+    for (auto attempt = 0; attempt != 2 && !cancelled_; ++attempt) {
+      auto const reused = !std::holds_alternative<std::monostate>(stream_);
+      if (!reused) {
+        if (auto const ec = co_await connect(); ec) {
+          if (!cancelled_) {
+            std::cerr << "Could not connect to " << target_.host_ << ": " << ec.message() << "\n";
+          }
+          disconnect();
+          co_return result{status::kError, {}};
+        }
+      }
+
+      auto res = http::response<http::string_body>{};
+      tcp().expires_after(timeout_);
+      auto ec = boost::system::error_code{};
+      if (auto* s = std::get_if<beast::ssl_stream<beast::tcp_stream>>(&stream_)) {
+        ec = co_await exchange(*s, req, buffer_, res);
+      } else {
+        ec = co_await exchange(std::get<beast::tcp_stream>(stream_), req, buffer_, res);
+      }
+      if (ec) {
+        disconnect();
+        if (reused) {
+          continue;
+        }
+        if (!cancelled_) {
+          std::cerr << "Could not fetch " << target_.target_ << ": " << ec.message() << "\n";
+        }
+        co_return result{status::kError, {}};
+      }
+
+      if (!res.keep_alive()) {
+        disconnect();
+      }
+
+      if (res.result() == http::status::not_modified) {
+        co_return result{status::kNotModified, {}};
+      }
+      if (res.result() != http::status::ok) {
+        std::cerr << "Upstream answered " << res.result_int() << " for " << target_.target_ << "\n";
+        co_return result{status::kError, {}};
+      }
+
+      etag_ = std::string{res[http::field::etag]};
+      last_modified_ = std::string{res[http::field::last_modified]};
+
+      // servers without validators still send the same bytes for an unchanged feed
+      auto const hash = std::hash<std::string_view>{}(res.body());
+      if (hash == body_hash_) {
+        co_return result{status::kNotModified, {}};
+      }
+      body_hash_ = hash;
+      co_return result{status::kModified, std::move(res.body())};
+    }
+    co_return result{status::kError, {}};
+  }
+
+}  // namespace tup::backend
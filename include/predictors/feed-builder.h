@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nigiri/types.h>
+
+#include "gtfs-rt/gtfs-realtime.pb.h"
+
+/**
+ * Keeps the trip updates of the output feed across prediction cycles.
+ * Trip updates are indexed by their nigiri trip index and their stop time
+ * updates by stop id, so inserting or updating a prediction takes constant
+ * time. The finished
+ * FeedMessage is created with build().
+ */
+class FeedBuilder {
+public:
+  /**
+   * Sets the stop update for a given trip id and stop id. If the trip update does not exist, it will be created. If the stop update does not exist, it will be created.
+   * @param trip index of the trip to set the update for
+   * @param tripID of the trip to set the update for
+   * @param stopID of the stop to set the update for, has to outlive the builder (e.g. a view into the timetable)
+   * @param vehicleID of the vehicle to set the update for
+   * @param routeID of the route to set the update for
+   * @param newArrivalTime of the stop to set the update for
+   * @param uncertainty of the predicted arrival time
+   */
+  void set_trip_update(nigiri::trip_idx_t trip, std::string_view tripID, std::string_view stopID, std::string_view vehicleID, std::string_view routeID, int64_t newArrivalTime, int32_t uncertainty);
+
+  /**
+   * Deletes all trip updates whose trip is not marked as current. Runs in a
+   * single pass over the trip updates and keeps the order of the others.
+   * @param currentTrips marks the current trips, indexed by trip index
+   */
+  void delete_old_trip_updates(std::vector<bool> const& currentTrips);
+
+  /// Removes all trip updates
+  void clear();
+
+  /// Number of trip updates
+  std::size_t size() const;
+
+  /**
+   * Creates the output feed with a full dataset header
+   * @return feed with one entity per trip update in insertion order
+   */
+  transit_realtime::FeedMessage build() const;
+
+private:
+  struct stopUpdate {
+    std::string_view stopID;
+    int64_t arrivalTime;
+    int32_t uncertainty;
+  };
+
+  struct tripUpdate {
+    nigiri::trip_idx_t trip;
+    std::string tripID;
+    std::string routeID;
+    std::string vehicleID;
+    int64_t timestamp;
+    std::vector<stopUpdate> stops;
+    std::unordered_map<std::string_view, std::uint32_t> stopIndex;
+  };
+
+  static constexpr std::uint32_t kNoPosition = std::numeric_limits<std::uint32_t>::max();
+
+  std::vector<tripUpdate> trips_;
+  // position of the trip update in trips_ for each trip index
+  std::vector<std::uint32_t> tripPosition_;
+};
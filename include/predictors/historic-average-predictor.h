@@ -1,5 +1,7 @@
 #pragma once
 #include <nigiri/timetable.h>
+#include "predictors/feed-builder.h"
+#include "predictors/prediction-context.h"
 #include "tup-utils/stopTimeStore.h"
 #include "gtfs-rt/gtfs-realtime.pb.h"
 
@@ -12,17 +14,18 @@ public:
   HistoricAveragePredictor();
   /**
    * Method to predict the next stop and arrival time
-   * @param tripUpdates current state of the generated tripUpdates feed
+   * @param tripUpdates builder holding the generated tripUpdates feed
    * @param vehiclePositions current VehiclePositions feed
-   * @param timetable matching the realtime feeds
+   * @param context timetable and lookup tables matching the realtime feeds
    */
-  void predict(transit_realtime::FeedMessage& tripUpdates, 
+  void predict(FeedBuilder& tripUpdates, 
               const transit_realtime::FeedMessage& vehiclePositions,
-              const nigiri::timetable& timetable);
+              const PredictionContext& context);
   /**
    * load Historic Data into store to allow to load collected protobuf file
    * @param stopTimes vector of stop times that should be stored in the store
+   * @param context timetable and lookup tables to resolve the trip and stop ids
    */
-  void loadHistoricData(const std::vector<stopTime>& stopTimes);
+  void loadHistoricData(const std::vector<stopTime>& stopTimes, const PredictionContext& context);
   stopTimeStore store_;
 };
\ No newline at end of file
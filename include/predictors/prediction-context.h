@@ -0,0 +1,16 @@
+#pragma once
+#include <nigiri/timetable.h>
+
+#include "predictors/route-geometry-cache.h"
+#include "predictors/trip-index.h"
+
+/**
+ * Static data the predictors need to match vehicle positions against the
+ * timetable. Everything in here is built once at startup and only read
+ * while predicting.
+ */
+struct PredictionContext {
+  nigiri::timetable const& timetable;
+  TripIndex const& trips;
+  RouteGeometryCache const& routes;
+};
@@ -1,12 +1,75 @@
 #pragma once
 #include <nigiri/timetable.h>
+#include <algorithm>
+#include <optional>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 #include "gtfs-rt/gtfs-realtime.pb.h"
 
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
+
+#include "predictors/prediction-context.h"
+#include "predictors/route-geometry-cache.h"
+#include "predictors/trip-index.h"
+
+/**
+ * A predicted arrival of a vehicle at a stop, produced by the parallel
+ * per-vehicle stage of a predictor and written to the output feed afterwards
+ */
+struct stopTimePrediction {
+  nigiri::trip_idx_t trip;
+  std::string tripID;
+  std::string_view stopID;
+  std::string vehicleID;
+  std::string routeID;
+  int64_t arrivalTime;
+  int32_t uncertainty;
+};
+
 class predictorUtils {
   public:
-    static std::vector<nigiri::location> get_stops_for_trip(nigiri::timetable const& timetable, std::string const& trip_id);
-    static auto convert_trip_id_to_idx(nigiri::timetable const& timetable, std::string const& trip_id) -> nigiri::trip_idx_t;
-    static void delete_old_trip_updates(std::unordered_set<std::string> currentTripIDs, transit_realtime::FeedMessage& outputFeed);
-    static void set_trip_update(std::string tripID, std::string_view stopID, std::string vehicleID, std::string routeID, int64_t newArrivalTime, int32_t uncertainty, transit_realtime::FeedMessage& outputFeed);
+    /**
+     * Runs predictVehicle for every entity of the vehicle positions feed in
+     * parallel (on the current task arena). Every thread collects its results
+     * in a buffer of its own, the buffers are merged in the order of the
+     * entities in the feed, so the result does not depend on the scheduling.
+     * @param vehiclePositions feed with the entities to predict
+     * @param predictVehicle called as predictVehicle(entity, out) and appends its predictions to out
+     * @return predictions of all vehicles in feed order
+     */
+    template <typename PredictVehicle>
+    static std::vector<stopTimePrediction> predict_vehicles(transit_realtime::FeedMessage const& vehiclePositions, PredictVehicle&& predictVehicle) {
+      using indexed_prediction = std::pair<int, stopTimePrediction>;
+      tbb::enumerable_thread_specific<std::vector<indexed_prediction>> buffers;
+      tbb::parallel_for(tbb::blocked_range<int>{0, vehiclePositions.entity_size()}, [&](tbb::blocked_range<int> const& range) {
+        auto& buffer = buffers.local();
+        std::vector<stopTimePrediction> predictions;
+        for (int i = range.begin(); i != range.end(); ++i) {
+          predictVehicle(vehiclePositions.entity(i), predictions);
+          for (stopTimePrediction& prediction : predictions) {
+            buffer.emplace_back(i, std::move(prediction));
+          }
+          predictions.clear();
+        }
+      });
+
+      std::vector<indexed_prediction> merged;
+      for (auto& buffer : buffers) {
+        std::ranges::move(buffer, std::back_inserter(merged));
+      }
+      std::ranges::stable_sort(merged, {}, &indexed_prediction::first);
+
+      std::vector<stopTimePrediction> result;
+      result.reserve(merged.size());
+      for (indexed_prediction& prediction : merged) {
+        result.push_back(std::move(prediction.second));
+      }
+      return result;
+    }
+
+    static RouteGeometry get_stops_for_trip(PredictionContext const& context, nigiri::trip_idx_t trip_idx);
+    static auto get_route_for_trip(nigiri::timetable const& timetable, nigiri::trip_idx_t trip_idx) -> std::optional<nigiri::route_idx_t>;
+    static auto convert_trip_id_to_idx(TripIndex const& tripIndex, std::string const& trip_id) -> std::optional<nigiri::trip_idx_t>;
 };
@@ -0,0 +1,50 @@
+#pragma once
+#include <nigiri/timetable.h>
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/**
+ * View on the stops of one route. All spans have the same length (one entry
+ * per stop of the route), segment_length[i] is the distance in meters from
+ * stop i to stop i + 1 and 0 for the last stop.
+ */
+struct RouteGeometry {
+  std::span<double const> lat;
+  std::span<double const> lng;
+  std::span<double const> segment_length;
+  std::span<nigiri::location_idx_t const> location;
+  std::span<std::string_view const> stop_id;
+
+  std::size_t size() const { return lat.size(); }
+  bool empty() const { return lat.empty(); }
+};
+
+/**
+ * Read-only cache of the stop sequence of every route of a timetable.
+ * The stops of all routes are stored in flat arrays (structure of arrays),
+ * so iterating over the stops of a route only touches contiguous memory.
+ */
+class RouteGeometryCache {
+public:
+  explicit RouteGeometryCache(nigiri::timetable const& timetable);
+
+  /**
+   * Returns the stops of a route
+   * @param route_idx of the route
+   * @return view on the stops of the route
+   */
+  RouteGeometry get(nigiri::route_idx_t route_idx) const;
+
+  std::size_t size() const;
+
+private:
+  std::vector<std::uint32_t> route_offsets_;
+  std::vector<double> lat_;
+  std::vector<double> lng_;
+  std::vector<double> segment_length_;
+  std::vector<nigiri::location_idx_t> location_;
+  std::vector<std::string_view> stop_id_;
+};
@@ -1,5 +1,7 @@
 #pragma once
 #include <nigiri/timetable.h>
+#include "predictors/feed-builder.h"
+#include "predictors/prediction-context.h"
 
 #include "gtfs-rt/gtfs-realtime.pb.h"
 
@@ -12,10 +14,10 @@ public:
 
   /**
    * Method to predict the next stop and arrival time
-   * @param tripUpdates current state of the generated tripUpdates feed
+   * @param tripUpdates builder holding the generated tripUpdates feed
    * @param vehiclePositions current VehiclePositions feed
-   * @param timetable matching the realtime feeds
+   * @param context timetable and lookup tables matching the realtime feeds
    */
-  static void predict(transit_realtime::FeedMessage& tripUpdates, const transit_realtime::FeedMessage& vehiclePositions,
-                          const nigiri::timetable& timetable);
+  static void predict(FeedBuilder& tripUpdates, const transit_realtime::FeedMessage& vehiclePositions,
+                          const PredictionContext& context);
 };
@@ -0,0 +1,33 @@
+#pragma once
+#include <nigiri/timetable.h>
+
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Lookup table from GTFS trip ids to the trip index used by nigiri.
+ * It is built once after the timetable has been loaded and only holds views
+ * into the timetable, so the timetable has to outlive the index.
+ */
+class TripIndex {
+public:
+  /**
+   * @param timetable to build the index for
+   * @param source only index trips of this dataset, all if not set
+   */
+  explicit TripIndex(nigiri::timetable const& timetable,
+                     std::optional<nigiri::source_idx_t> source = std::nullopt);
+
+  /**
+   * Looks up the trip index for a trip id
+   * @param trip_id as found in the realtime feed
+   * @return index of the trip or nothing if the timetable does not know the trip
+   */
+  std::optional<nigiri::trip_idx_t> find(std::string_view trip_id) const;
+
+  std::size_t size() const;
+
+private:
+  std::unordered_map<std::string_view, nigiri::trip_idx_t> trips_;
+};
@@ -1,20 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <optional>
 #include <string>
-#include <tuple>
-#include <unordered_map>
-
-/**
- * Hash operation for the std::tuple type, necessary to store it in a hash map
- */
-template <>
-struct std::hash<std::tuple<std::string, std::string, std::string>> {
-  size_t operator()(const tuple<string, string, string>& t) const {
-    return hash<string>{}(get<0>(t)) ^ (hash<string>{}(get<1>(t)) << 1) ^
-           (hash<string>{}(get<2>(t)) << 2);
-  }
-};
+#include <string_view>
+#include <vector>
 
 
 /**
@@ -29,31 +19,80 @@ struct stopTime {
 
 
 /**
- * Stores historic stopTimes which are then used for prediction
+ * Stores historic stopTimes which are then used for prediction.
+ *
+ * Trips and stops are identified by interned integer ids (the nigiri trip and
+ * location indices) and days by their number since 1970-01-01. Every
+ * trip/stop pair has one slot in an open-addressing table holding the running
+ * sum and count of its arrival times, so averages are answered in constant
+ * time. The single samples are packed into 8 bytes each and chained per slot
+ * in one arena, which makes storing allocation-free once the capacity is
+ * reserved.
  */
 class stopTimeStore {
+public:
+  /// Days since 1970-01-01, must be below 2^15
+  using day_t = std::uint16_t;
+
   /**
-   * Create a stopTimeStore storing the memory-mapped files
+   * Reserves space so that storing does not allocate.
+   * @param keys expected number of trip/stop pairs
+   * @param samples expected number of events
    */
-public:
-  std::unordered_map<std::tuple<std::string, std::string, std::string>,
-                     std::int64_t> stopTimes;
+  void reserve(std::size_t keys, std::size_t samples);
+
   /**
-   * Store the given StopTimeEvent in the hash map
-   * @param trip_id to be stored
-   * @param stop_id to be stored
-   * @param arrival_time to be stored
-   * @param date to be stored
+   * Store the given StopTimeEvent. A second event for the same trip, stop
+   * and day replaces the first one.
+   * @param trip id of the trip
+   * @param stop id of the stop
+   * @param arrival_time seconds since midnight
+   * @param day of the event
    */
-  void store(std::string const& trip_id,
-                    std::string const& stop_id,
-                    std::int64_t arrival_time,
-                    std::string date);
+  void store(std::uint32_t trip, std::uint32_t stop, std::int64_t arrival_time, day_t day);
+
   /**
    * Retrieves the average arrival time for all similar past StopTimeEvents for Prediction
-   * @param trip_id to identify similar events
-   * @param stop_id to identify similar events
-   * @return Average arrival time
+   * @param trip id of the trip
+   * @param stop id of the stop
+   * @return Average arrival time in seconds since midnight, 0 if there are no similar events
    */
-  int64_t getAverageArrivalTime(std::string const& trip_id, std::string const& stop_id);
+  int64_t getAverageArrivalTime(std::uint32_t trip, std::uint32_t stop) const;
+
+  /**
+   * @return number of stored events
+   */
+  std::size_t size() const;
+
+  /**
+   * @param date formatted as YYYY-MM-DD
+   * @return the day or nothing if the date is malformed or out of range
+   */
+  static std::optional<day_t> toDay(std::string_view date);
+
+private:
+  static constexpr std::uint32_t kEmpty = UINT32_MAX;
+  static constexpr std::uint32_t kNoSample = UINT32_MAX;
+
+  /// All events of one trip at one stop
+  struct aggregate {
+    std::uint32_t trip = kEmpty;
+    std::uint32_t stop = kEmpty;
+    std::int64_t sum = 0;
+    std::uint32_t count = 0;
+    /// Most recently stored sample in samples_
+    std::uint32_t head = kNoSample;
+    /// Latest day of all samples, later days are appended without a search
+    day_t last_day = 0;
+  };
+
+  /// Index of the slot for the key, either holding it or empty
+  std::size_t findSlot(std::uint32_t trip, std::uint32_t stop) const;
+  void grow();
+
+  /// Open-addressing table with linear probing, the size is a power of two
+  std::vector<aggregate> table_;
+  std::size_t keys_ = 0;
+  /// Packed samples: next sample (32 bits) | day (15 bits) | arrival time (17 bits)
+  std::vector<std::uint64_t> samples_;
 };
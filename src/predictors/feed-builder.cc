@@ -0,0 +1,108 @@
+#include "predictors/feed-builder.h"
+
+#include <chrono>
+#include <ctime>
+
+/**
+ * Sets the stop update for a given trip id and stop id. If the trip update does not exist, it will be created. If the stop update does not exist, it will be created.
+ * @param trip index of the trip to set the update for
+ * @param tripID of the trip to set the update for
+ * @param stopID of the stop to set the update for
+ * @param vehicleID of the vehicle to set the update for
+ * @param routeID of the route to set the update for
+ * @param newArrivalTime of the stop to set the update for
+ * @param uncertainty of the predicted arrival time
+ */
+void FeedBuilder::set_trip_update(nigiri::trip_idx_t trip_idx, std::string_view tripID, std::string_view stopID, std::string_view vehicleID, std::string_view routeID, int64_t newArrivalTime, int32_t uncertainty) {
+  auto const t = static_cast<std::size_t>(cista::to_idx(trip_idx));
+  if (t >= tripPosition_.size()) {
+    tripPosition_.resize(t + 1, kNoPosition);
+  }
+  if (tripPosition_[t] == kNoPosition) {
+    tripPosition_[t] = static_cast<std::uint32_t>(trips_.size());
+    trips_.push_back({trip_idx, std::string{tripID}, std::string{routeID}, std::string{vehicleID}, 0, {}, {}});
+  }
+  tripUpdate& trip = trips_[tripPosition_[t]];
+
+  auto [stop_it, stopInserted] = trip.stopIndex.try_emplace(stopID, static_cast<std::uint32_t>(trip.stops.size()));
+  if (stopInserted) {
+    trip.stops.push_back({stopID, 0, 0});
+  }
+  stopUpdate& stop = trip.stops[stop_it->second];
+
+  auto now = std::chrono::system_clock::now();
+  trip.timestamp = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+  stop.arrivalTime = newArrivalTime;
+  stop.uncertainty = uncertainty;
+}
+
+/**
+ * Deletes all trip updates whose trip is not marked as current. The remaining
+ * trip updates are moved to the front in their current order and the vector
+ * is truncated afterwards, so this takes linear time no matter how many trip
+ * updates are deleted.
+ * @param currentTrips marks the current trips, indexed by trip index
+ */
+void FeedBuilder::delete_old_trip_updates(std::vector<bool> const& currentTrips) {
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < trips_.size(); ++i) {
+    auto const t = static_cast<std::size_t>(cista::to_idx(trips_[i].trip));
+    if (t < currentTrips.size() && currentTrips[t]) {
+      if (kept != i) {
+        trips_[kept] = std::move(trips_[i]);
+      }
+      tripPosition_[t] = static_cast<std::uint32_t>(kept);
+      ++kept;
+    } else {
+      tripPosition_[t] = kNoPosition;
+    }
+  }
+  trips_.erase(trips_.begin() + static_cast<std::ptrdiff_t>(kept), trips_.end());
+}
+
+void FeedBuilder::clear() {
+  for (const tripUpdate& trip : trips_) {
+    tripPosition_[cista::to_idx(trip.trip)] = kNoPosition;
+  }
+  trips_.clear();
+}
+
+std::size_t FeedBuilder::size() const {
+  return trips_.size();
+}
+
+/**
+ * Creates the output feed with a full dataset header
+ * @return feed with one entity per trip update in insertion order
+ */
+transit_realtime::FeedMessage FeedBuilder::build() const {
+  transit_realtime::FeedMessage feed;
+  transit_realtime::FeedHeader* header = feed.mutable_header();
+  header->set_gtfs_realtime_version("2.0");
+  header->set_incrementality(transit_realtime::FeedHeader_Incrementality_FULL_DATASET);
+  header->set_timestamp(time(nullptr));
+
+  feed.mutable_entity()->Reserve(static_cast<int>(trips_.size()));
+  for (const tripUpdate& trip : trips_) {
+    transit_realtime::FeedEntity* entity = feed.add_entity();
+    entity->set_id(trip.tripID);
+
+    transit_realtime::TripUpdate* tripUpdate = entity->mutable_trip_update();
+    transit_realtime::TripDescriptor* descriptor = tripUpdate->mutable_trip();
+    descriptor->set_trip_id(trip.tripID);
+    descriptor->set_route_id(trip.routeID);
+    descriptor->set_schedule_relationship(transit_realtime::TripDescriptor_ScheduleRelationship_SCHEDULED);
+    tripUpdate->mutable_vehicle()->set_id(trip.vehicleID);
+    tripUpdate->set_timestamp(trip.timestamp);
+
+    for (const stopUpdate& stop : trip.stops) {
+      transit_realtime::TripUpdate_StopTimeUpdate* stop_time_update = tripUpdate->add_stop_time_update();
+      stop_time_update->set_stop_id(std::string{stop.stopID});
+      stop_time_update->set_schedule_relationship(transit_realtime::TripUpdate_StopTimeUpdate_ScheduleRelationship_SCHEDULED);
+      transit_realtime::TripUpdate_StopTimeEvent* arrival = stop_time_update->mutable_arrival();
+      arrival->set_time(stop.arrivalTime);
+      arrival->set_uncertainty(stop.uncertainty);
+    }
+  }
+  return feed;
+}
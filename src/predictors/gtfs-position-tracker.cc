@@ -14,66 +14,76 @@ GTFSPositionTracker::GTFSPositionTracker() = default;
  * This checks if any of the vehicle Positions is close to a stop. If so,
  * a tripUpdate for the according trip and stop will be created.
  *
- * @param tripUpdates current tripUpdate feed to be updated
+ * @param tripUpdates builder holding the tripUpdate feed to be updated
  * @param vehiclePositions positions of vehicles as feed
- * @param timetable timetable to match the vehiclePositions to stops
+ * @param context timetable and lookup tables to match the vehiclePositions to stops
  */
 void GTFSPositionTracker::predict(
-    transit_realtime::FeedMessage& tripUpdates,
+    FeedBuilder& tripUpdates,
     const transit_realtime::FeedMessage& vehiclePositions,
-    const nigiri::timetable& timetable) {
-  transit_realtime::FeedMessage tripUpdatesCopy;
-  tripUpdatesCopy.CopyFrom(tripUpdates);
-  //Save all current tripIds in vehiclePositions
-  std::unordered_set<std::string> currentTripIDs = {};
-
+    const PredictionContext& context) {
+  //Save all current trips in vehiclePositions
+  std::vector<bool> currentTrips(context.timetable.trip_transport_ranges_.size(), false);
   for (const transit_realtime::FeedEntity& entity : vehiclePositions.entity()) {
+    if (entity.has_vehicle()) {
+      if (const auto trip_idx = predictorUtils::convert_trip_id_to_idx(context.trips, entity.vehicle().trip().trip_id())) {
+        currentTrips[cista::to_idx(*trip_idx)] = true;
+      }
+    }
+  }
+
+  const std::vector<stopTimePrediction> predictions = predictorUtils::predict_vehicles(
+      vehiclePositions,
+      [&](const transit_realtime::FeedEntity& entity, std::vector<stopTimePrediction>& out) {
     // For this prototype we only care about vehicle positions. Service alerts and other trip updates are ignored
     if (entity.has_vehicle()) {
       const transit_realtime::VehiclePosition& vehicle_position = entity.vehicle();
       // Get Trip ID
       std::string tripID = vehicle_position.trip().trip_id();
-      currentTripIDs.insert(tripID);
 
       const std::string routeID = vehicle_position.trip().route_id();
       const std::string vehicleID = vehicle_position.vehicle().id();
 
-      // check for each stop if we are close
-      for (nigiri::location location : predictorUtils::get_stops_for_trip(timetable, tripID)) {
+      const std::optional<nigiri::trip_idx_t> trip_idx = predictorUtils::convert_trip_id_to_idx(context.trips, tripID);
+      if (!trip_idx.has_value()) {
+        return;
+      }
 
-        namespace bg = boost::geometry;
-        bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
-            vehicle_point{};
+      namespace bg = boost::geometry;
+      bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
+          vehicle_point{};
+      bg::set<0>(vehicle_point, vehicle_position.position().longitude());
+      bg::set<1>(vehicle_point, vehicle_position.position().latitude());
+
+      // check for each stop if we are close
+      const RouteGeometry stops = predictorUtils::get_stops_for_trip(context, *trip_idx);
+      for (std::size_t i = 0; i < stops.size(); ++i) {
         bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
             location_point{};
-
-        bg::set<0>(vehicle_point, vehicle_position.position().longitude());
-        bg::set<1>(vehicle_point, vehicle_position.position().latitude());
-        bg::set<0>(location_point, location.pos_.lng_);
-        bg::set<1>(location_point, location.pos_.lat_);
+        bg::set<0>(location_point, stops.lng[i]);
+        bg::set<1>(location_point, stops.lat[i]);
 
         if (bg::distance(vehicle_point, location_point, bg::strategy::distance::haversine(6371000.0)) < 100) {
           auto now = std::chrono::system_clock::now();
           const auto current_time = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
 
-          predictorUtils::set_trip_update(
-              tripID,
-              location.id_,
-              vehicleID,
-              routeID,
-              current_time,
-              0,
-              tripUpdatesCopy);
+          out.push_back({*trip_idx, tripID, stops.stop_id[i], vehicleID, routeID, current_time, 0});
         }
       }
     }
+  });
+
+  for (const stopTimePrediction& prediction : predictions) {
+    tripUpdates.set_trip_update(
+        prediction.trip,
+        prediction.tripID,
+        prediction.stopID,
+        prediction.vehicleID,
+        prediction.routeID,
+        prediction.arrivalTime,
+        prediction.uncertainty);
   }
   
   // Remove TripUpdates for trips not in vehiclePositions anymore
-  predictorUtils::delete_old_trip_updates(currentTripIDs, tripUpdatesCopy);
-
-  transit_realtime::FeedHeader* header = tripUpdatesCopy.mutable_header();
-  header->set_timestamp(time(nullptr));
-
-  tripUpdates = tripUpdatesCopy;
+  tripUpdates.delete_old_trip_updates(currentTrips);
 }
@@ -2,14 +2,32 @@
 #include "predictors/predictor-utils.h"
 
 #include <iostream>
-#include <iomanip>
+#include <chrono>
 #include <ctime>
-#include <sstream>
 
 #include <boost/geometry/algorithms/distance.hpp>
 #include <boost/geometry/geometries/point.hpp>
 #include <boost/geometry/strategies/spherical/distance_haversine.hpp>
 
+namespace {
+
+/**
+ * Resolves the stop id of a trip to its location, which is the key of the store
+ * @param stops of the trip
+ * @param stop_id as found in the feed
+ * @return location index of the stop or nothing if the trip does not serve it
+ */
+std::optional<std::uint32_t> find_stop(RouteGeometry const& stops, std::string_view stop_id) {
+  for (std::size_t i = 0; i < stops.size(); ++i) {
+    if (stops.stop_id[i] == stop_id) {
+      return nigiri::to_idx(stops.location[i]);
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
 HistoricAveragePredictor::HistoricAveragePredictor() = default;
 
 /**
@@ -17,20 +35,23 @@ HistoricAveragePredictor::HistoricAveragePredictor() = default;
  * This checks when the trip reached the following trip in the last n trips
  * and uses this as a prediction.
  *
- * @param tripUpdates current tripUpdate feed to be updated
+ * @param tripUpdates builder holding the tripUpdate feed to be updated
  * @param vehiclePositions positions of vehicles as feed
- * @param timetable timetable to match the vehiclePositions to stops
+ * @param context timetable and lookup tables to match the vehiclePositions to stops
  */
 void HistoricAveragePredictor::predict(
-    transit_realtime::FeedMessage& tripUpdates,
+    FeedBuilder& tripUpdates,
     const transit_realtime::FeedMessage& vehiclePositions,
-    const nigiri::timetable& timetable) {
+    const PredictionContext& context) {
   // Part 1: Storing of departures based on GTFS-Position-Tracker
   auto now = std::chrono::system_clock::now();
   auto current_time = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
-  auto today = std::format("{:%Y-%m-%d}", now);
+  auto const today = static_cast<stopTimeStore::day_t>(
+      std::chrono::floor<std::chrono::days>(now).time_since_epoch().count());
 
-  for (const transit_realtime::FeedEntity& entity : vehiclePositions.entity()) {
+  const std::vector<stopTimePrediction> arrivals = predictorUtils::predict_vehicles(
+      vehiclePositions,
+      [&](const transit_realtime::FeedEntity& entity, std::vector<stopTimePrediction>& out) {
     // For this prototype we only care about vehicle positions. Service alerts and other trip updates are ignored
     if (entity.has_vehicle()) {
       const transit_realtime::VehiclePosition& vehiclePosition = entity.vehicle();
@@ -39,37 +60,53 @@ void HistoricAveragePredictor::predict(
       std::string routeID = vehiclePosition.trip().route_id();
       std::string vehicleID = vehiclePosition.vehicle().id();
 
+      const std::optional<nigiri::trip_idx_t> trip_idx = predictorUtils::convert_trip_id_to_idx(context.trips, tripID);
+      if (!trip_idx.has_value()) {
+        return;
+      }
+
+      namespace bg = boost::geometry;
+      bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
+          vehicle_point{};
+      bg::set<0>(vehicle_point, vehiclePosition.position().longitude());
+      bg::set<1>(vehicle_point, vehiclePosition.position().latitude());
+
       // Get a stop list for a given trip
-      std::vector<nigiri::location> stopList = predictorUtils::get_stops_for_trip(timetable, tripID);
+      const RouteGeometry stopList = predictorUtils::get_stops_for_trip(context, *trip_idx);
       // check for each stop if we are close
-      for (nigiri::location location : stopList) {
-        namespace bg = boost::geometry;
-        bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
-            vehicle_point{};
+      for (std::size_t i = 0; i < stopList.size(); ++i) {
         bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
             locationPoint{};
-
-        bg::set<0>(vehicle_point, vehiclePosition.position().longitude());
-        bg::set<1>(vehicle_point, vehiclePosition.position().latitude());
-        bg::set<0>(locationPoint, location.pos_.lng_);
-        bg::set<1>(locationPoint, location.pos_.lat_);
+        bg::set<0>(locationPoint, stopList.lng[i]);
+        bg::set<1>(locationPoint, stopList.lat[i]);
 
         const auto distance = bg::distance(vehicle_point, locationPoint, bg::strategy::distance::haversine(6371000.0));
 
         if (distance < 100) {
-          this->store_.store(tripID, location.id_.data(), current_time % 86400, today);
+          out.push_back({*trip_idx, tripID, stopList.stop_id[i], vehicleID, routeID, current_time % 86400, 0});
         }
       }
     }
+  });
+  for (const stopTimePrediction& arrival : arrivals) {
+    const auto stop = find_stop(predictorUtils::get_stops_for_trip(context, arrival.trip), arrival.stopID);
+    if (stop.has_value()) {
+      this->store_.store(nigiri::to_idx(arrival.trip), *stop, arrival.arrivalTime, today);
+    }
   }
   // Part 2: Prediction based on the stored departures/arrivals
   // Empty output feed, as we generate all tripUpdates every time new
-  tripUpdates.Clear();
-  transit_realtime::FeedHeader* header = tripUpdates.mutable_header();
-  header->set_gtfs_realtime_version("2.0");
-  header->set_incrementality(transit_realtime::FeedHeader_Incrementality_FULL_DATASET);
-  header->set_timestamp(time(nullptr));
-  for (const transit_realtime::FeedEntity& entity : vehiclePositions.entity()) {
+  tripUpdates.clear();
+  // Arrival times are stored as seconds since midnight
+  struct tm* localTime = localtime(&current_time);
+  localTime->tm_hour = 0;
+  localTime->tm_min = 0;
+  localTime->tm_sec = 0;
+  const int64_t midnight = mktime(localTime);
+
+  const std::vector<stopTimePrediction> predictions = predictorUtils::predict_vehicles(
+      vehiclePositions,
+      [&](const transit_realtime::FeedEntity& entity, std::vector<stopTimePrediction>& out) {
     // For this prototype we only care about vehicle positions. Service alerts and other trip updates are ignored
     if (entity.has_vehicle()) {
       const transit_realtime::VehiclePosition& vehicle_position = entity.vehicle();
@@ -78,68 +115,77 @@ void HistoricAveragePredictor::predict(
       std::string routeID = vehicle_position.trip().route_id();
       std::string vehicleID = vehicle_position.vehicle().id();
 
+      const std::optional<nigiri::trip_idx_t> trip_idx = predictorUtils::convert_trip_id_to_idx(context.trips, tripID);
+      if (!trip_idx.has_value()) {
+        return;
+      }
+
       // Get a stop list for a given trip
-      std::vector<nigiri::location> stop_list = predictorUtils::get_stops_for_trip(timetable, tripID);
+      const RouteGeometry stop_list = predictorUtils::get_stops_for_trip(context, *trip_idx);
+      if (stop_list.empty()) {
+        return;
+      }
+
+      namespace bg = boost::geometry;
+      bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
+          vehicle_point{};
+      bg::set<0>(vehicle_point, vehicle_position.position().longitude());
+      bg::set<1>(vehicle_point, vehicle_position.position().latitude());
+
       auto old_distance = std::numeric_limits<double>::max();
-      nigiri::location& prediction_stop = stop_list.back();
-      for (nigiri::location location : stop_list) {
-        namespace bg = boost::geometry;
-        bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
-            vehicle_point{};
+      std::size_t prediction_stop = stop_list.size() - 1;
+      for (std::size_t i = 0; i < stop_list.size(); ++i) {
         bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>
             location_point{};
-
-        bg::set<0>(vehicle_point, vehicle_position.position().longitude());
-        bg::set<1>(vehicle_point, vehicle_position.position().latitude());
-        bg::set<0>(location_point, location.pos_.lng_);
-        bg::set<1>(location_point, location.pos_.lat_);
+        bg::set<0>(location_point, stop_list.lng[i]);
+        bg::set<1>(location_point, stop_list.lat[i]);
 
         double new_distance = bg::distance(vehicle_point, location_point, bg::strategy::distance::haversine(6371000.0));
         if (old_distance > new_distance) {
-          prediction_stop = location;
+          prediction_stop = i;
           break;
         }
       }
-      auto arrival_time = this->store_.getAverageArrivalTime(tripID, prediction_stop.id_.data());
+      auto arrival_time = this->store_.getAverageArrivalTime(
+          nigiri::to_idx(*trip_idx), nigiri::to_idx(stop_list.location[prediction_stop]));
       if (arrival_time == 0) {
-        continue;
+        return;
       }
-      // Create a prediction and add it to outputFeed
-      transit_realtime::FeedEntity* new_entity = tripUpdates.add_entity();
-      new_entity->set_id(tripID);
-
-      transit_realtime::TripUpdate* tripUpdateToUpdate = new_entity->mutable_trip_update();
-      transit_realtime::TripDescriptor* trip = tripUpdateToUpdate->mutable_trip();
-      trip->set_trip_id(tripID);
-      trip->set_route_id(routeID);
-      tripUpdateToUpdate->mutable_vehicle()->set_id(vehicleID);
-
-      transit_realtime::TripUpdate_StopTimeUpdate* stop_time_update = tripUpdateToUpdate->add_stop_time_update();
-      stop_time_update->set_stop_id(prediction_stop.id_);
-      transit_realtime::TripUpdate_StopTimeEvent* arrivalToUpdate = stop_time_update->mutable_arrival();
-
-      tripUpdateToUpdate->set_timestamp(current_time);
-      struct tm* localTime = localtime(&current_time);
-      localTime->tm_hour = 0;
-      localTime->tm_min = 0;
-      localTime->tm_sec = 0;
-      arrival_time = arrival_time + mktime(localTime);
-      arrivalToUpdate->set_time(arrival_time);
-      arrivalToUpdate->set_uncertainty(0);
+      out.push_back({*trip_idx, tripID, stop_list.stop_id[prediction_stop], vehicleID, routeID, arrival_time + midnight, 0});
     }
+  });
+
+  // Add the predictions to outputFeed
+  for (const stopTimePrediction& prediction : predictions) {
+    tripUpdates.set_trip_update(
+        prediction.trip,
+        prediction.tripID,
+        prediction.stopID,
+        prediction.vehicleID,
+        prediction.routeID,
+        prediction.arrivalTime,
+        prediction.uncertainty);
   }
 }
 
 /**
  * Helping method to load historic data from protobuf files
  * @param stopTimes vector of stopTimes to load
+ * @param context timetable and lookup tables to resolve the trip and stop ids
  */
-void HistoricAveragePredictor::loadHistoricData(const std::vector<stopTime>& stopTimes) {
-  const auto t = std::time(nullptr);
-  const auto tm = *std::localtime(&t);
-  for (stopTime stopTime : stopTimes) {
-    std::ostringstream oss;
-    oss << std::put_time(&tm, "%d-%m-%Y %H-%M-%S");
-    this->store_.store(stopTime.trip_id, stopTime.stop_id, stopTime.arrival_time % 86400, oss.str());
+void HistoricAveragePredictor::loadHistoricData(const std::vector<stopTime>& stopTimes,
+                                                const PredictionContext& context) {
+  this->store_.reserve(0, this->store_.size() + stopTimes.size());
+  for (const stopTime& stopTime : stopTimes) {
+    const auto trip_idx = predictorUtils::convert_trip_id_to_idx(context.trips, stopTime.trip_id);
+    const auto day = stopTimeStore::toDay(stopTime.date);
+    if (!trip_idx.has_value() || !day.has_value()) {
+      continue;
+    }
+    const auto stop = find_stop(predictorUtils::get_stops_for_trip(context, *trip_idx), stopTime.stop_id);
+    if (!stop.has_value()) {
+      continue;
+    }
+    this->store_.store(nigiri::to_idx(*trip_idx), *stop, stopTime.arrival_time % 86400, *day);
   }
 }
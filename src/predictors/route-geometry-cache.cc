@@ -0,0 +1,67 @@
+#include "predictors/route-geometry-cache.h"
+
+#include <boost/geometry/algorithms/distance.hpp>
+#include <boost/geometry/geometries/point.hpp>
+#include <boost/geometry/strategies/spherical/distance_haversine.hpp>
+
+/**
+ * Collects the stops of all routes of the timetable and precomputes the
+ * length of each segment between two consecutive stops.
+ * @param timetable to build the cache for
+ */
+RouteGeometryCache::RouteGeometryCache(nigiri::timetable const& timetable) {
+  namespace bg = boost::geometry;
+  using Point = bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>>;
+
+  auto const n_routes = timetable.route_location_seq_.size();
+  route_offsets_.reserve(n_routes + 1);
+  route_offsets_.push_back(0);
+
+  for (std::size_t r = 0; r < n_routes; ++r) {
+    auto const& stop_sequence =
+        timetable.route_location_seq_[nigiri::route_idx_t{static_cast<unsigned>(r)}];
+    for (unsigned const s : stop_sequence) {
+      nigiri::location_idx_t const location_idx = nigiri::stop{s}.location_idx();
+      geo::latlng const& pos = timetable.locations_.coordinates_[location_idx];
+      lat_.push_back(pos.lat_);
+      lng_.push_back(pos.lng_);
+      location_.push_back(location_idx);
+      stop_id_.push_back(timetable.locations_.ids_[location_idx].view());
+    }
+    route_offsets_.push_back(static_cast<std::uint32_t>(lat_.size()));
+  }
+
+  segment_length_.resize(lat_.size(), 0.0);
+  for (std::size_t r = 0; r < n_routes; ++r) {
+    for (auto i = route_offsets_[r]; i + 1 < route_offsets_[r + 1]; ++i) {
+      Point const from{lng_[i], lat_[i]};
+      Point const to{lng_[i + 1], lat_[i + 1]};
+      segment_length_[i] = bg::distance(from, to, bg::strategy::distance::haversine(6371000.0));
+    }
+  }
+}
+
+/**
+ * Returns the stops of a route
+ * @param route_idx of the route
+ * @return view on the stops of the route
+ */
+RouteGeometry RouteGeometryCache::get(nigiri::route_idx_t const route_idx) const {
+  auto const r = static_cast<std::size_t>(cista::to_idx(route_idx));
+  if (r + 1 >= route_offsets_.size()) {
+    return {};
+  }
+  auto const begin = route_offsets_[r];
+  auto const n = route_offsets_[r + 1] - begin;
+  return {
+      .lat = std::span{lat_}.subspan(begin, n),
+      .lng = std::span{lng_}.subspan(begin, n),
+      .segment_length = std::span{segment_length_}.subspan(begin, n),
+      .location = std::span{location_}.subspan(begin, n),
+      .stop_id = std::span{stop_id_}.subspan(begin, n),
+  };
+}
+
+std::size_t RouteGeometryCache::size() const {
+  return route_offsets_.size() - 1;
+}
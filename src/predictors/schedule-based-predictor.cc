@@ -47,27 +47,34 @@ ScheduleBasedPredictor::ScheduleBasedPredictor() = default;
  * This checks where the vehicle currently is in the schedule and checks if it
  * is too late. If so, it interpolates how much time the vehicle will be too
  * late at the next stop
- * @param tripUpdates current tripUpdate feed to be updated
+ * @param tripUpdates builder holding the tripUpdate feed to be updated
  * @param vehiclePositions positions of vehicles as feed
- * @param timetable timetable to match the vehiclePositions to stops
+ * @param context timetable and lookup tables to match the vehiclePositions to stops
  */
 void ScheduleBasedPredictor::predict(
-    transit_realtime::FeedMessage& tripUpdates,
+    FeedBuilder& tripUpdates,
     const transit_realtime::FeedMessage& vehiclePositions,
-    const nigiri::timetable& timetable) {
-    transit_realtime::FeedMessage tripUpdatesCopy;
-    tripUpdatesCopy.CopyFrom(tripUpdates);
-    // Save all current tripIds in vehiclePositions
-    std::unordered_set<std::string> currentTripIDs = {};
-
+    const PredictionContext& context) {
+    // Save all current trips in vehiclePositions
+    std::vector<bool> currentTrips(context.timetable.trip_transport_ranges_.size(), false);
     for (const transit_realtime::FeedEntity& entity : vehiclePositions.entity()) {
+        if (entity.has_vehicle() && entity.vehicle().has_trip() && entity.vehicle().has_position()) {
+            if (const auto trip_idx = predictorUtils::convert_trip_id_to_idx(context.trips, entity.vehicle().trip().trip_id())) {
+                currentTrips[cista::to_idx(*trip_idx)] = true;
+            }
+        }
+    }
+
+    const std::vector<stopTimePrediction> predictions = predictorUtils::predict_vehicles(
+        vehiclePositions,
+        [&](const transit_realtime::FeedEntity& entity, std::vector<stopTimePrediction>& out) {
         if (!entity.has_vehicle()) {
-            continue;
+            return;
         }
 
         const  transit_realtime::VehiclePosition& vehicle_position = entity.vehicle();
         if (!vehicle_position.has_trip() || !vehicle_position.has_position()) {
-            continue;
+            return;
         }
 
         // vehicle position as Boost Geometry Punkt
@@ -76,14 +83,17 @@ void ScheduleBasedPredictor::predict(
         boost::geometry::set<1>(vehicle_point, vehicle_position.position().latitude());
 
         std::string tripID = vehicle_position.trip().trip_id();
-        currentTripIDs.insert(tripID);
 
         std::string routeID = vehicle_position.trip().route_id();
         std::string vehicleID = vehicle_position.vehicle().id();
-        const std::vector<nigiri::location>& stops = predictorUtils::get_stops_for_trip(timetable, tripID);
+        const std::optional<nigiri::trip_idx_t> trip_idx = predictorUtils::convert_trip_id_to_idx(context.trips, tripID);
+        if (!trip_idx.has_value()) {
+            return;
+        }
+        const RouteGeometry stops = predictorUtils::get_stops_for_trip(context, *trip_idx);
         
         if (stops.size() < 2) {
-            continue;
+            return;
         }
 
         // find the closest segment to the vehicle position
@@ -92,15 +102,12 @@ void ScheduleBasedPredictor::predict(
         Point closest_foot_point;
 
         for (size_t i = 0; i < stops.size() - 1; ++i) {
-            const nigiri::location& current_stop = stops[i];
-            const nigiri::location& next_stop = stops[i + 1];
-
             // Create points for the two stops
             Point stop1_point, stop2_point;
-            boost::geometry::set<0>(stop1_point, current_stop.pos_.lng_);
-            boost::geometry::set<1>(stop1_point, current_stop.pos_.lat_);
-            boost::geometry::set<0>(stop2_point, next_stop.pos_.lng_);
-            boost::geometry::set<1>(stop2_point, next_stop.pos_.lat_);
+            boost::geometry::set<0>(stop1_point, stops.lng[i]);
+            boost::geometry::set<1>(stop1_point, stops.lat[i]);
+            boost::geometry::set<0>(stop2_point, stops.lng[i + 1]);
+            boost::geometry::set<1>(stop2_point, stops.lat[i + 1]);
 
             // Calculate the foot point on the segment between the two stops
             Point foot_point = calculateFootPoint(vehicle_point, stop1_point, stop2_point);
@@ -118,27 +125,23 @@ void ScheduleBasedPredictor::predict(
                 closest_foot_point = foot_point;
             }
         }
-      Point segment_start, segment_end;
-      boost::geometry::set<0>(segment_start, stops[closest_segment_start].pos_.lng_);
-      boost::geometry::set<1>(segment_start, stops[closest_segment_start].pos_.lat_);
-      boost::geometry::set<0>(segment_end, stops[closest_segment_start + 1].pos_.lng_);
-      boost::geometry::set<1>(segment_end,
-                              stops[closest_segment_start + 1].pos_.lat_);
+      Point segment_start;
+      boost::geometry::set<0>(segment_start, stops.lng[closest_segment_start]);
+      boost::geometry::set<1>(segment_start, stops.lat[closest_segment_start]);
       const double progress_way = boost::geometry::distance(segment_start, closest_foot_point, boost::geometry::strategy::distance::haversine(6371000.0)) /
-        boost::geometry::distance(segment_start, segment_end, boost::geometry::strategy::distance::haversine(6371000.0));
+        stops.segment_length[closest_segment_start];
       // progress_time: (current_time - a.departure_time) / (b.arrival_time - a.departure_time)
       std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
       const long current_time =
           std::chrono::duration_cast<std::chrono::seconds>(
               now.time_since_epoch())
               .count();
-      const  nigiri::trip_idx_t trip_idx = predictorUtils::convert_trip_id_to_idx(timetable, tripID);
-      const nigiri::paged_vecvec<cista::strong<unsigned, nigiri::_trip_idx>, cista::pair<cista::strong<unsigned, nigiri::_transport_idx>, nigiri::interval<unsigned short>>>& transport_ranges = timetable.trip_transport_ranges_;
-      const cista::strong<unsigned, nigiri::_transport_idx> t_idx = transport_ranges[trip_idx][0].first;
+      const nigiri::paged_vecvec<cista::strong<unsigned, nigiri::_trip_idx>, cista::pair<cista::strong<unsigned, nigiri::_transport_idx>, nigiri::interval<unsigned short>>>& transport_ranges = context.timetable.trip_transport_ranges_;
+      const cista::strong<unsigned, nigiri::_transport_idx> t_idx = transport_ranges[*trip_idx][0].first;
       // convert to sys_days
       const  std::chrono::time_point<std::chrono::system_clock, std::chrono::duration<int, std::ratio<86400>>> today = date::floor<date::days>(now);
-      const nigiri::day_idx_t current_day_idx = timetable.day_idx(today);
-      nigiri::unixtime_t departure_time = timetable.event_time(
+      const nigiri::day_idx_t current_day_idx = context.timetable.day_idx(today);
+      nigiri::unixtime_t departure_time = context.timetable.event_time(
           nigiri::transport{
               t_idx,
               current_day_idx
@@ -148,7 +151,7 @@ void ScheduleBasedPredictor::predict(
               static_cast<unsigned>(closest_segment_start))},
           nigiri::event_type::kDep
       );
-      nigiri::unixtime_t arrival_time = timetable.event_time(
+      nigiri::unixtime_t arrival_time = context.timetable.event_time(
           nigiri::transport{t_idx, current_day_idx},
           // Convert from `location_idx_t` to `stop_idx_t`
           nigiri::stop_idx_t{
@@ -163,23 +166,22 @@ void ScheduleBasedPredictor::predict(
         // Calculate predicted arrival: current_time + time needed for the segment * (1 - progress_way)
         const long predicted_arrival = current_time + static_cast<int>((next_stop_arrival_time - departure_time.time_since_epoch().count()) * (1 - progress_way));
 
-        //Update feed accordingly
-        predictorUtils::set_trip_update(
-            tripID,
-            stops[closest_segment_start + 1].id_,
-            vehicleID,
-            routeID,
-            predicted_arrival,
-            0,
-            tripUpdatesCopy);
-
+        out.push_back({*trip_idx, tripID, stops.stop_id[closest_segment_start + 1], vehicleID, routeID, predicted_arrival, 0});
       }
+    });
+
+    //Update feed accordingly
+    for (const stopTimePrediction& prediction : predictions) {
+        tripUpdates.set_trip_update(
+            prediction.trip,
+            prediction.tripID,
+            prediction.stopID,
+            prediction.vehicleID,
+            prediction.routeID,
+            prediction.arrivalTime,
+            prediction.uncertainty);
     }
 
     // Delete old trip updates
-    predictorUtils::delete_old_trip_updates(currentTripIDs, tripUpdatesCopy);
-
-    transit_realtime::FeedHeader* header = tripUpdatesCopy.mutable_header();
-    header->set_timestamp(time(nullptr));
-    tripUpdates = tripUpdatesCopy;
+    tripUpdates.delete_old_trip_updates(currentTrips);
 }
\ No newline at end of file
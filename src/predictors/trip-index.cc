@@ -0,0 +1,37 @@
+#include "predictors/trip-index.h"
+
+/**
+ * Builds the lookup table from all trip ids of the timetable. If a trip id
+ * occurs more than once (e.g. in different sources), the first trip wins.
+ * Restricting the index to one source resolves such clashes when several
+ * agencies are loaded at once.
+ * @param timetable to build the index for
+ * @param source only index trips of this dataset, all if not set
+ */
+TripIndex::TripIndex(nigiri::timetable const& timetable,
+                     std::optional<nigiri::source_idx_t> source) {
+  trips_.reserve(timetable.trip_id_to_idx_.size());
+  for (auto const& [trip_id_idx, trip_idx] : timetable.trip_id_to_idx_) {
+    if (source.has_value() && timetable.trip_id_src_[trip_id_idx] != *source) {
+      continue;
+    }
+    trips_.emplace(timetable.trip_id_strings_[trip_id_idx].view(), trip_idx);
+  }
+}
+
+/**
+ * Looks up the trip index for a trip id
+ * @param trip_id as found in the realtime feed
+ * @return index of the trip or nothing if the timetable does not know the trip
+ */
+std::optional<nigiri::trip_idx_t> TripIndex::find(std::string_view trip_id) const {
+  auto const it = trips_.find(trip_id);
+  if (it == trips_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+std::size_t TripIndex::size() const {
+  return trips_.size();
+}
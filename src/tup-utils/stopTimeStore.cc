@@ -1,37 +1,156 @@
 #include "tup-utils/stopTimeStore.h"
 
-/**
-   * Store the given StopTimeEvent in the hash map
-   * @param trip_id to be stored
-   * @param stop_id to be stored
-   * @param arrival_time to be stored
-   * @param date to be stored
-   */
-void stopTimeStore::store(std::string const& trip_id,
-                          std::string const& stop_id,
-                          std::int64_t arrival_time,
-                          std::string date) {
-  const auto key = std::make_tuple(trip_id, stop_id, date);
-  stopTimes[key] = arrival_time;
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <utility>
+
+namespace {
+
+constexpr auto kSecondsPerDay = std::int64_t{86400};
+constexpr auto kTimeBits = 17U;
+constexpr auto kDayBits = 15U;
+constexpr auto kTimeMask = (std::uint64_t{1} << kTimeBits) - 1U;
+constexpr auto kDayMask = (std::uint64_t{1} << kDayBits) - 1U;
+
+std::uint64_t pack(std::uint32_t next, stopTimeStore::day_t day, std::int64_t time) {
+  return (std::uint64_t{next} << (kDayBits + kTimeBits)) |
+         ((std::uint64_t{day} & kDayMask) << kTimeBits) |
+         (static_cast<std::uint64_t>(time) & kTimeMask);
+}
+
+std::uint32_t nextOf(std::uint64_t sample) {
+  return static_cast<std::uint32_t>(sample >> (kDayBits + kTimeBits));
+}
+
+stopTimeStore::day_t dayOf(std::uint64_t sample) {
+  return static_cast<stopTimeStore::day_t>((sample >> kTimeBits) & kDayMask);
+}
+
+std::int64_t timeOf(std::uint64_t sample) {
+  return static_cast<std::int64_t>(sample & kTimeMask);
+}
+
+std::size_t hashKey(std::uint32_t trip, std::uint32_t stop) {
+  // splitmix64 finalizer, spreads consecutive ids over the table
+  auto x = (std::uint64_t{trip} << 32U) | stop;
+  x = (x ^ (x >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27U)) * 0x94d049bb133111ebULL;
+  return static_cast<std::size_t>(x ^ (x >> 31U));
+}
+
+}  // namespace
+
+void stopTimeStore::reserve(std::size_t keys, std::size_t samples) {
+  samples_.reserve(samples);
+  while (table_.size() * 7 < keys * 10) {
+    grow();
+  }
+}
+
+std::size_t stopTimeStore::findSlot(std::uint32_t trip, std::uint32_t stop) const {
+  auto const mask = table_.size() - 1U;
+  auto slot = hashKey(trip, stop) & mask;
+  while (table_[slot].trip != kEmpty &&
+         (table_[slot].trip != trip || table_[slot].stop != stop)) {
+    slot = (slot + 1U) & mask;
+  }
+  return slot;
+}
+
+void stopTimeStore::grow() {
+  auto old = std::exchange(table_, std::vector<aggregate>(table_.empty() ? 64U : table_.size() * 2U));
+  for (auto const& entry : old) {
+    if (entry.trip != kEmpty) {
+      table_[findSlot(entry.trip, entry.stop)] = entry;
+    }
+  }
 }
 
 /**
-   * Retrieves the average arrival time for all similar past StopTimeEvents for Prediction
-   * @param trip_id to identify similar events
-   * @param stop_id to identify similar events
-   * @return Average arrival time
-   */
-int64_t stopTimeStore::getAverageArrivalTime(std::string const& trip_id, std::string const& stop_id) {
-  int64_t sum = 0;
-  int64_t count = 0;
-  for (auto const& stoptime : stopTimes) {
-    if (std::get<0>(stoptime.first) == trip_id && std::get<1>(stoptime.first) == stop_id) {
-      sum += stoptime.second;
-      count++;
+ * Store the given StopTimeEvent. A second event for the same trip, stop
+ * and day replaces the first one.
+ * @param trip id of the trip
+ * @param stop id of the stop
+ * @param arrival_time seconds since midnight
+ * @param day of the event
+ */
+void stopTimeStore::store(std::uint32_t trip, std::uint32_t stop, std::int64_t arrival_time, day_t day) {
+  if ((keys_ + 1U) * 10U > table_.size() * 7U) {
+    grow();
+  }
+  auto const time = ((arrival_time % kSecondsPerDay) + kSecondsPerDay) % kSecondsPerDay;
+
+  auto& entry = table_[findSlot(trip, stop)];
+  if (entry.trip == kEmpty) {
+    entry.trip = trip;
+    entry.stop = stop;
+    ++keys_;
+  }
+
+  // events arrive in day order, so only a day not after the latest one can be a duplicate
+  for (auto i = entry.count != 0 && day <= entry.last_day ? entry.head : kNoSample; i != kNoSample;
+       i = nextOf(samples_[i])) {
+    if (dayOf(samples_[i]) == day) {
+      entry.sum += time - timeOf(samples_[i]);
+      samples_[i] = pack(nextOf(samples_[i]), day, time);
+      return;
     }
   }
-  if (count == 0) {
+
+  samples_.push_back(pack(entry.head, day, time));
+  entry.head = static_cast<std::uint32_t>(samples_.size() - 1U);
+  entry.sum += time;
+  entry.last_day = entry.count == 0 ? day : std::max(entry.last_day, day);
+  ++entry.count;
+}
+
+/**
+ * Retrieves the average arrival time for all similar past StopTimeEvents for Prediction
+ * @param trip id of the trip
+ * @param stop id of the stop
+ * @return Average arrival time in seconds since midnight, 0 if there are no similar events
+ */
+int64_t stopTimeStore::getAverageArrivalTime(std::uint32_t trip, std::uint32_t stop) const {
+  if (table_.empty()) {
+    return 0;
+  }
+  auto const& entry = table_[findSlot(trip, stop)];
+  if (entry.trip == kEmpty || entry.count == 0) {
     return 0;
   }
-  return sum / count;
-}
\ No newline at end of file
+  return entry.sum / entry.count;
+}
+
+std::size_t stopTimeStore::size() const {
+  return samples_.size();
+}
+
+std::optional<stopTimeStore::day_t> stopTimeStore::toDay(std::string_view date) {
+  auto year = 0;
+  auto month = 0U;
+  auto day = 0U;
+  auto const* const end = date.data() + date.size();
+  auto r = std::from_chars(date.data(), end, year);
+  if (r.ec != std::errc{} || r.ptr == end || *r.ptr != '-') {
+    return std::nullopt;
+  }
+  r = std::from_chars(r.ptr + 1, end, month);
+  if (r.ec != std::errc{} || r.ptr == end || *r.ptr != '-') {
+    return std::nullopt;
+  }
+  r = std::from_chars(r.ptr + 1, end, day);
+  if (r.ec != std::errc{} || r.ptr != end) {
+    return std::nullopt;
+  }
+
+  auto const ymd = std::chrono::year{year} / std::chrono::month{month} / std::chrono::day{day};
+  if (!ymd.ok()) {
+    return std::nullopt;
+  }
+  auto const days = std::chrono::sys_days{ymd}.time_since_epoch().count();
+  if (days < 0 || static_cast<std::uint64_t>(days) > kDayMask) {
+    return std::nullopt;
+  }
+  return static_cast<day_t>(days);
+}
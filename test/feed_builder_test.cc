@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "predictors/feed-builder.h"
+
+TEST(FeedBuilderTest, SetAndDeleteTripUpdates) {
+  FeedBuilder builder;
+
+  builder.set_trip_update(nigiri::trip_idx_t{0}, "trip0", "stop1", "vehicle0", "route0", 100, 0);
+  builder.set_trip_update(nigiri::trip_idx_t{1}, "trip1", "stop1", "vehicle1", "route0", 200, 0);
+  builder.set_trip_update(nigiri::trip_idx_t{2}, "trip2", "stop2", "vehicle2", "route1", 300, 0);
+  // Update of an existing stop and a new stop for trip0
+  builder.set_trip_update(nigiri::trip_idx_t{0}, "trip0", "stop1", "vehicle0", "route0", 150, 30);
+  builder.set_trip_update(nigiri::trip_idx_t{0}, "trip0", "stop2", "vehicle0", "route0", 400, 0);
+  EXPECT_EQ(builder.size(), 3);
+
+  // trip1 has ended
+  std::vector<bool> currentTrips = {true, false, true};
+  builder.delete_old_trip_updates(currentTrips);
+  EXPECT_EQ(builder.size(), 2);
+
+  // trip1 comes back and is appended at the end
+  builder.set_trip_update(nigiri::trip_idx_t{1}, "trip1", "stop3", "vehicle1", "route0", 500, 0);
+
+  const transit_realtime::FeedMessage feed = builder.build();
+  EXPECT_EQ(feed.header().incrementality(), transit_realtime::FeedHeader_Incrementality_FULL_DATASET);
+  ASSERT_EQ(feed.entity_size(), 3);
+  EXPECT_EQ(feed.entity(0).trip_update().trip().trip_id(), "trip0");
+  EXPECT_EQ(feed.entity(1).trip_update().trip().trip_id(), "trip2");
+  EXPECT_EQ(feed.entity(2).trip_update().trip().trip_id(), "trip1");
+
+  const transit_realtime::TripUpdate& trip0 = feed.entity(0).trip_update();
+  ASSERT_EQ(trip0.stop_time_update_size(), 2);
+  EXPECT_EQ(trip0.stop_time_update(0).stop_id(), "stop1");
+  EXPECT_EQ(trip0.stop_time_update(0).arrival().time(), 150);
+  EXPECT_EQ(trip0.stop_time_update(0).arrival().uncertainty(), 30);
+  EXPECT_EQ(trip0.stop_time_update(1).stop_id(), "stop2");
+  EXPECT_EQ(feed.entity(2).trip_update().stop_time_update(0).arrival().time(), 500);
+}
+
+TEST(FeedBuilderTest, DeleteOldTripUpdatesBenchmark) {
+  constexpr unsigned kTrips = 50000;
+  const std::string stopID = "stop";
+
+  FeedBuilder builder;
+  for (unsigned i = 0; i < kTrips; ++i) {
+    const std::string tripID = "trip" + std::to_string(i);
+    builder.set_trip_update(nigiri::trip_idx_t{i}, tripID, stopID, "vehicle", "route", i, 0);
+  }
+
+  // End of service: only every tenth trip is still running
+  std::vector<bool> currentTrips(kTrips, false);
+  for (unsigned i = 0; i < kTrips; i += 10) {
+    currentTrips[i] = true;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  builder.delete_old_trip_updates(currentTrips);
+  const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+  std::cout << "delete_old_trip_updates with " << kTrips << " trip updates: " << duration.count() << "us" << std::endl;
+  RecordProperty("delete_old_trip_updates_us", std::to_string(duration.count()));
+
+  ASSERT_EQ(builder.size(), kTrips / 10);
+  const transit_realtime::FeedMessage feed = builder.build();
+  for (int i = 0; i < feed.entity_size(); ++i) {
+    EXPECT_EQ(feed.entity(i).id(), "trip" + std::to_string(i * 10));
+  }
+}
@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include "tup-utils/stopTimeStore.h"
+
+/**
+ * Fills a stopTimeStore with samples (default 10M: 2000 trips x 25 stops x
+ * 200 days) and measures how long storing and looking up the averages takes.
+ * Not part of ctest, run it manually: store_benchmark [samples]
+ */
+int main(int argc, char const* argv[]) {
+  using clock = std::chrono::steady_clock;
+  constexpr auto kTrips = 2000U;
+  constexpr auto kStops = 25U;
+
+  auto const samples = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000ULL;
+  auto const days = static_cast<unsigned>(std::max(1ULL, samples / (kTrips * kStops)));
+
+  stopTimeStore store;
+  store.reserve(std::size_t{kTrips} * kStops, samples);
+  auto const store_start = clock::now();
+  for (auto d = 0U; d != days; ++d) {
+    for (auto t = 0U; t != kTrips; ++t) {
+      for (auto s = 0U; s != kStops; ++s) {
+        store.store(t, s, 36000 + t + s * 60 + d % 7, static_cast<stopTimeStore::day_t>(19723 + d));
+      }
+    }
+  }
+  auto const store_time = std::chrono::duration<double>(clock::now() - store_start).count();
+
+  auto const lookup_start = clock::now();
+  auto checksum = std::int64_t{0};
+  for (auto t = 0U; t != kTrips; ++t) {
+    for (auto s = 0U; s != kStops; ++s) {
+      checksum += store.getAverageArrivalTime(t, s);
+    }
+  }
+  auto const lookup_time = std::chrono::duration<double>(clock::now() - lookup_start).count();
+  auto const lookups = kTrips * kStops;
+
+  std::cout << "samples: " << store.size() << "\n"
+            << "store: " << store_time << " s (" << store_time * 1e9 / static_cast<double>(store.size())
+            << " ns/sample)\n"
+            << "lookup: " << lookup_time * 1e9 / lookups << " ns/average over " << lookups
+            << " lookups (checksum " << checksum << ")\n";
+}
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 #include "tup-utils/stopTimeStore.h"
 
+namespace {
+constexpr stopTimeStore::day_t kMar20 = 19802;  // 2024-03-20
+constexpr stopTimeStore::day_t kMar21 = 19803;  // 2024-03-21
+}  // namespace
+
 TEST(StoreTest, CompleteTest) {
   stopTimeStore store;
 
@@ -11,15 +16,72 @@ TEST(StoreTest, CompleteTest) {
   // Zeitstempel für 12:20 Uhr
   constexpr int64_t time3 = 39600;  // 12:20:00
 
-  store.store("trip1", "stop1", time1, "2024-03-20");
-  store.store("trip1", "stop1", time2, "2024-03-21");
-  store.store("trip2", "stop1", time3, "2024-03-20");
+  store.store(1, 11, time1, kMar20);
+  store.store(1, 11, time2, kMar21);
+  store.store(2, 11, time3, kMar20);
 
   // Test für trip1/stop1 - Durchschnitt von time1 und time2
-  const int64_t averageTime = store.getAverageArrivalTime("trip1", "stop1");
+  const int64_t averageTime = store.getAverageArrivalTime(1, 11);
   EXPECT_EQ(averageTime, 38700);  // (39000 + 38400) / 2
 
   // Test für trip2/stop1 - Sollte exakt time3 sein
-  const int64_t singleTime = store.getAverageArrivalTime("trip2", "stop1");
+  const int64_t singleTime = store.getAverageArrivalTime(2, 11);
   EXPECT_EQ(singleTime, time3);
 }
+
+TEST(StoreTest, SameDateReplacesEvent) {
+  stopTimeStore store;
+
+  store.store(1, 11, 38400, kMar20);
+  store.store(1, 11, 39000, kMar21);
+  // the second event of the same day replaces the first one
+  store.store(1, 11, 40200, kMar20);
+
+  EXPECT_EQ(store.size(), 2U);
+  EXPECT_EQ(store.getAverageArrivalTime(1, 11), 39600);  // (40200 + 39000) / 2
+}
+
+TEST(StoreTest, UnknownTripOrStop) {
+  stopTimeStore store;
+
+  store.store(1, 11, 38400, kMar20);
+
+  EXPECT_EQ(store.getAverageArrivalTime(2, 11), 0);
+  EXPECT_EQ(store.getAverageArrivalTime(1, 12), 0);
+  EXPECT_EQ(store.size(), 1U);
+}
+
+TEST(StoreTest, StopsOfSameTripAreSeparate) {
+  stopTimeStore store;
+
+  store.store(1, 11, 38400, kMar20);
+  store.store(1, 12, 39000, kMar20);
+  store.store(1, 12, 39600, kMar21);
+
+  EXPECT_EQ(store.getAverageArrivalTime(1, 11), 38400);
+  EXPECT_EQ(store.getAverageArrivalTime(1, 12), 39300);
+}
+
+TEST(StoreTest, ManyKeys) {
+  stopTimeStore store;
+
+  for (std::uint32_t trip = 0; trip < 1000; ++trip) {
+    for (std::uint32_t stop = 0; stop < 20; ++stop) {
+      store.store(trip, stop, 36000 + trip + stop, kMar20);
+      store.store(trip, stop, 36002 + trip + stop, kMar21);
+    }
+  }
+
+  EXPECT_EQ(store.size(), 40000U);
+  EXPECT_EQ(store.getAverageArrivalTime(0, 0), 36001);
+  EXPECT_EQ(store.getAverageArrivalTime(999, 19), 37019);
+  EXPECT_EQ(store.getAverageArrivalTime(1000, 0), 0);
+}
+
+TEST(StoreTest, ToDay) {
+  EXPECT_EQ(stopTimeStore::toDay("1970-01-01"), 0);
+  EXPECT_EQ(stopTimeStore::toDay("2024-03-20"), kMar20);
+  EXPECT_EQ(stopTimeStore::toDay("2024-02-30"), std::nullopt);
+  EXPECT_EQ(stopTimeStore::toDay("20-03-2024"), std::nullopt);
+  EXPECT_EQ(stopTimeStore::toDay("2024-03-20x"), std::nullopt);
+}